@@ -0,0 +1,85 @@
+#include "intrusive.h"
+
+#include <shared-from-this/shared.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kIterations = 2'000'000;
+
+struct IntrusiveValue : AtomicRefCounted<IntrusiveValue> {
+    int value = 0;
+};
+
+struct SharedValue {
+    int value = 0;
+};
+
+// Runs `op` `kIterations` times on each of `num_threads` threads and returns
+// operations per second.
+template <typename Op>
+double Measure(int num_threads, Op op) {
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back([&op] {
+            for (int j = 0; j < kIterations; ++j) {
+                op();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    return static_cast<double>(num_threads) * kIterations / elapsed.count();
+}
+
+void BenchCopies() {
+    std::printf("Copies of one pointer, ops/s\n");
+    for (int num_threads : {1, 2, 4, 8}) {
+        IntrusivePtr<IntrusiveValue> intrusive = MakeIntrusive<IntrusiveValue>();
+        double intrusive_ops = Measure(num_threads, [&] {
+            IntrusivePtr<IntrusiveValue> copy = intrusive;
+        });
+        SharedPtr<SharedValue, AtomicPolicy> shared = MakeShared<SharedValue, AtomicPolicy>();
+        double shared_ops = Measure(num_threads, [&] {
+            SharedPtr<SharedValue, AtomicPolicy> copy = shared;
+        });
+        std::printf("  %d threads: IntrusivePtr %12.0f  SharedPtr %12.0f\n", num_threads,
+                    intrusive_ops, shared_ops);
+    }
+}
+
+// Sole owners take the fast path of `AtomicCounter::DecRef`.
+void BenchSoleOwner() {
+    std::printf("Create and release, ops/s\n");
+    for (int num_threads : {1, 2, 4, 8}) {
+        double intrusive_ops = Measure(num_threads, [] {
+            auto ptr = MakeIntrusive<IntrusiveValue>();
+            ptr->value++;
+        });
+        double shared_ops = Measure(num_threads, [] {
+            auto ptr = MakeShared<SharedValue, AtomicPolicy>();
+            ptr->value++;
+        });
+        std::printf("  %d threads: IntrusivePtr %12.0f  SharedPtr %12.0f\n", num_threads,
+                    intrusive_ops, shared_ops);
+    }
+}
+
+}  // namespace
+
+int main() {
+    BenchCopies();
+    BenchSoleOwner();
+}
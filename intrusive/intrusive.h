@@ -1,24 +1,108 @@
 #pragma once
 
+#include <atomic>
+#include <cassert>
 #include <cstddef>  // for std::nullptr_t
+#include <cstdint>
+#include <type_traits>
 #include <utility>  // for std::exchange / std::swap
 
-class SimpleCounter {
+// Counts from this value on are immortal: they no longer change and the
+// object is never destroyed. Reached by `MakeImmortal()` or by saturation.
+constexpr size_t kImmortalRefCount = ~size_t(0) / 2 + 1;
+
+// Counters and the bases holding them copy as fresh zeros: a copy of an
+// object is a new object with no references yet.
+
+// Counter of `Int` width: narrow ones shrink small objects. Overflowing one
+// asserts in debug builds and saturates otherwise, leaking the object rather
+// than freeing it too early.
+template <typename Int>
+class BasicCounter {
+    static_assert(std::is_unsigned_v<Int>);
+
 public:
+    static constexpr Int kImmortal = static_cast<Int>(Int(~Int(0)) / 2 + 1);
+
+    BasicCounter() = default;
+    BasicCounter(const BasicCounter&) {
+    }
+    BasicCounter& operator=(const BasicCounter&) {
+        return *this;
+    }
+
     size_t IncRef() {
-        ++count_;
+        if (count_ < kImmortal) {
+            ++count_;
+            assert(count_ < kImmortal && "reference counter overflow");
+        }
         return count_;
     }
     size_t DecRef() {
-        --count_;
+        if (count_ < kImmortal) {
+            --count_;
+        }
         return count_;
     }
     size_t RefCount() const {
         return count_;
     }
+    void MakeImmortal() {
+        count_ |= kImmortal;
+    }
+
+private:
+    Int count_ = 0;
+};
+
+using SimpleCounter = BasicCounter<size_t>;
+using Counter8 = BasicCounter<uint8_t>;
+using Counter16 = BasicCounter<uint16_t>;
+using Counter32 = BasicCounter<uint32_t>;
+
+// Counter for objects shared between threads.
+class AtomicCounter {
+public:
+    AtomicCounter() = default;
+    AtomicCounter(const AtomicCounter&) {
+    }
+    AtomicCounter& operator=(const AtomicCounter&) {
+        return *this;
+    }
+
+    size_t IncRef() {
+        size_t count = count_.load(std::memory_order_relaxed);
+        if (count >= kImmortalRefCount) {
+            return count;
+        }
+        return count_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    size_t DecRef() {
+        size_t count = count_.load(std::memory_order_acquire);
+        if (count >= kImmortalRefCount) {
+            return count;
+        }
+        // The only owner: nobody else can take a reference, so skip the atomic RMW.
+        if (count == 1) {
+            count_.store(0, std::memory_order_relaxed);
+            return 0;
+        }
+        count = count_.fetch_sub(1, std::memory_order_release) - 1;
+        if (count == 0) {
+            // Sees the writes of the other owners before the object is destroyed.
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return count;
+    }
+    size_t RefCount() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+    void MakeImmortal() {
+        count_.fetch_or(kImmortalRefCount, std::memory_order_relaxed);
+    }
 
 private:
-    size_t count_ = 0;
+    std::atomic<size_t> count_ = 0;
 };
 
 struct DefaultDelete {
@@ -28,38 +112,145 @@ struct DefaultDelete {
     }
 };
 
+// `Counter` that `RefCounted` does not keep in front of `Derived`: `Derived`
+// declares a `Counter` field itself, e.g. in padding between its other fields,
+// and a function `Counter& RefCounterOf(Derived&)` found by ADL that returns it.
+template <typename Counter>
+struct EmbeddedCounter {};
+
+template <typename Counter>
+constexpr bool kEmbeddedCounter = false;
+template <typename Counter>
+constexpr bool kEmbeddedCounter<EmbeddedCounter<Counter>> = true;
+
+template <typename Counter>
+struct CounterStorage {
+    Counter counter_;
+};
+template <typename Counter>
+struct CounterStorage<EmbeddedCounter<Counter>> {};
+
 template <typename Derived, typename Counter, typename Deleter>
-class RefCounted {
+class RefCounted : private CounterStorage<Counter> {
 public:
     // Increase reference counter.
     void IncRef() {
-        counter_.IncRef();
+        GetCounter().IncRef();
     }
 
     // Decrease reference counter.
     // Destroy object using Deleter when the last instance dies.
     void DecRef() {
-        if (counter_.DecRef() == 0) {
+        if (GetCounter().DecRef() == 0) {
             Deleter::Destroy(static_cast<Derived*>(this));
         }
     }
 
-    RefCounted& operator=(const RefCounted& other) {
+    RefCounted() = default;
+    RefCounted(const RefCounted&) : CounterStorage<Counter>() {
+    }
+    RefCounted& operator=(const RefCounted&) {
         return *this;
     }
 
     // Get current counter value (the number of strong references).
     size_t RefCount() const {
-        return counter_.RefCount();
+        return const_cast<RefCounted*>(this)->GetCounter().RefCount();
+    }
+
+    // The object is never destroyed from now on, and `IncRef`/`DecRef` only
+    // read the counter. Needs a reference held by the caller.
+    void MakeImmortal() {
+        GetCounter().MakeImmortal();
     }
 
 private:
-    Counter counter_;
+    auto& GetCounter() {
+        if constexpr (kEmbeddedCounter<Counter>) {
+            return RefCounterOf(static_cast<Derived&>(*this));
+        } else {
+            return this->counter_;
+        }
+    }
 };
 
 template <typename Derived, typename D = DefaultDelete>
 using SimpleRefCounted = RefCounted<Derived, SimpleCounter, D>;
 
+template <typename Derived, typename D = DefaultDelete>
+using AtomicRefCounted = RefCounted<Derived, AtomicCounter, D>;
+
+// Counts of an object that has been weakly referenced. Outlives the object
+// while weak references to it remain.
+struct WeakRefTable {
+    size_t strong;
+    // Weak references plus one held by the object while it is alive.
+    size_t weak;
+};
+
+// `RefCounted` that supports `IntrusiveWeakPtr`. Keeps a single word: the
+// strong count, replaced by a pointer to a side table the first time a weak
+// reference is taken. Not thread-safe, like `SimpleCounter`.
+template <typename Derived, typename Deleter = DefaultDelete>
+class WeakRefCounted {
+public:
+    WeakRefCounted() = default;
+    WeakRefCounted(const WeakRefCounted&) {
+    }
+    WeakRefCounted& operator=(const WeakRefCounted&) {
+        return *this;
+    }
+
+    ~WeakRefCounted() {
+        if (HasTable()) {
+            WeakRefTable* table = GetTable();
+            table->strong = 0;
+            if (--table->weak == 0) {
+                delete table;
+            }
+        }
+    }
+
+    void IncRef() {
+        if (HasTable()) {
+            ++GetTable()->strong;
+        } else {
+            word_ += kOne;
+        }
+    }
+    void DecRef() {
+        size_t count = HasTable() ? --GetTable()->strong : (word_ -= kOne) / kOne;
+        if (count == 0) {
+            Deleter::Destroy(static_cast<Derived*>(this));
+        }
+    }
+    size_t RefCount() const {
+        return HasTable() ? GetTable()->strong : word_ / kOne;
+    }
+
+    // The side table, allocated on the first call.
+    WeakRefTable* GetWeakRefTable() {
+        if (!HasTable()) {
+            auto* table = new WeakRefTable{word_ / kOne, 1};
+            word_ = reinterpret_cast<uintptr_t>(table) | kTableTag;
+        }
+        return GetTable();
+    }
+
+private:
+    static constexpr uintptr_t kTableTag = 1;
+    static constexpr uintptr_t kOne = 2;
+
+    bool HasTable() const {
+        return word_ & kTableTag;
+    }
+    WeakRefTable* GetTable() const {
+        return reinterpret_cast<WeakRefTable*>(word_ & ~kTableTag);
+    }
+
+    uintptr_t word_ = 0;
+};
+
 template <typename T>
 class IntrusivePtr {
     template <typename Y>
@@ -188,3 +379,80 @@ template <typename T, typename... Args>
 IntrusivePtr<T> MakeIntrusive(Args&&... args) {
     return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
 }
+
+// Observer of an object derived from `WeakRefCounted`.
+template <typename T>
+class IntrusiveWeakPtr {
+    template <typename Y>
+    friend class IntrusiveWeakPtr;
+
+public:
+    // Constructors
+    IntrusiveWeakPtr() : ptr_(nullptr), table_(nullptr) {
+    }
+    template <typename Y>
+    IntrusiveWeakPtr(const IntrusivePtr<Y>& other) : ptr_(other.Get()), table_(nullptr) {
+        if (ptr_ != nullptr) {
+            table_ = ptr_->GetWeakRefTable();
+            ++table_->weak;
+        }
+    }
+    IntrusiveWeakPtr(const IntrusiveWeakPtr& other) : ptr_(other.ptr_), table_(other.table_) {
+        if (table_ != nullptr) {
+            ++table_->weak;
+        }
+    }
+    template <typename Y>
+    IntrusiveWeakPtr(const IntrusiveWeakPtr<Y>& other) : ptr_(other.ptr_), table_(other.table_) {
+        if (table_ != nullptr) {
+            ++table_->weak;
+        }
+    }
+    IntrusiveWeakPtr(IntrusiveWeakPtr&& other) noexcept
+        : ptr_(std::exchange(other.ptr_, nullptr)), table_(std::exchange(other.table_, nullptr)) {
+    }
+
+    // `operator=`-s
+    IntrusiveWeakPtr& operator=(const IntrusiveWeakPtr& other) {
+        IntrusiveWeakPtr(other).Swap(*this);
+        return *this;
+    }
+    IntrusiveWeakPtr& operator=(IntrusiveWeakPtr&& other) noexcept {
+        IntrusiveWeakPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    // Destructor
+    ~IntrusiveWeakPtr() {
+        Reset();
+    }
+
+    // Modifiers
+    void Reset() {
+        if (table_ != nullptr && --table_->weak == 0) {
+            delete table_;
+        }
+        ptr_ = nullptr;
+        table_ = nullptr;
+    }
+    void Swap(IntrusiveWeakPtr& other) {
+        std::swap(ptr_, other.ptr_);
+        std::swap(table_, other.table_);
+    }
+
+    // Observers
+    size_t UseCount() const {
+        return table_ ? table_->strong : 0;
+    }
+    bool Expired() const {
+        return UseCount() == 0;
+    }
+    // Returns an empty pointer if the object has expired.
+    IntrusivePtr<T> Lock() const {
+        return Expired() ? IntrusivePtr<T>() : IntrusivePtr<T>(ptr_);
+    }
+
+private:
+    T* ptr_;
+    WeakRefTable* table_;
+};
@@ -0,0 +1,376 @@
+#pragma once
+
+#include "intrusive.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class ObjectPool;
+
+// Base of pooled objects: the last reference returns the object to its pool
+// instead of destroying it. `Counter` is one of the counters of `RefCounted`;
+// objects shared between threads need `AtomicCounter`.
+template <typename Derived, typename Counter = SimpleCounter>
+class ObjectInPool {
+public:
+    void IncRef() {
+        counter_.IncRef();
+    }
+
+    void DecRef() {
+        if (counter_.DecRef() == 0) {
+            home_->Release(static_cast<Derived*>(this));
+        }
+    }
+
+    size_t RefCount() const {
+        return counter_.RefCount();
+    }
+
+    void SetHome(ObjectPool<Derived>* pool) {
+        home_ = pool;
+    }
+
+private:
+    Counter counter_;
+    ObjectPool<Derived>* home_ = nullptr;
+};
+
+template <typename Derived, typename Counter>
+std::true_type DetectObjectInPool(const ObjectInPool<Derived, Counter>*);
+std::false_type DetectObjectInPool(...);
+
+// Pool of constructed objects. Released objects keep their state and are
+// handed out again, most recently released first; constructor arguments only
+// matter for new objects.
+//
+// Every thread keeps a magazine of released objects per pool and touches no
+// shared state while it neither runs dry nor overflows. Overflowing magazines
+// hand a batch to a lock-free global depot, and empty ones refill from it
+// before constructing new objects. New objects are placed in slabs that grow
+// twice up to `kMaxSlabSize` objects.
+//
+// With `max_available` set, objects released beyond that many available ones
+// are destroyed, and slabs left without objects are freed.
+//
+// The pool must outlive its objects; destroying it destroys all of them.
+template <typename T>
+class ObjectPool {
+    static_assert(decltype(DetectObjectInPool(std::declval<T*>()))::value, "Unsupported type");
+
+    struct Slab;
+
+    struct Slot {
+        alignas(T) std::byte object[sizeof(T)];
+        Slot* next;
+        // Set in the first slot of a batch inside the depot.
+        Slot* next_batch;
+        size_t batch_size;
+        Slab* slab;
+        bool alive;
+
+        T* Object() {
+            return std::launder(reinterpret_cast<T*>(object));
+        }
+    };
+
+    struct Slab {
+        Slab* prev;
+        Slab* next;
+        size_t capacity;
+        size_t used;
+        // Objects in the slab, plus one while new objects go there.
+        std::atomic<size_t> live;
+
+        Slot* Slots() {
+            return reinterpret_cast<Slot*>(reinterpret_cast<std::byte*>(this) + kSlotsOffset);
+        }
+    };
+
+    static constexpr size_t kSlotsOffset =
+        (sizeof(Slab) + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot);
+    static constexpr bool kOverAligned = alignof(Slot) > __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+public:
+    static constexpr size_t kBatchSize = 32;
+    static constexpr size_t kMaxSlabSize = 64;
+    static constexpr size_t kUnlimited = ~size_t(0);
+
+    explicit ObjectPool(size_t max_available = kUnlimited)
+        : id_(next_id_.fetch_add(1, std::memory_order_relaxed)), max_available_(max_available) {
+        Registry& registry = GetRegistry();
+        std::lock_guard guard(registry.mutex);
+        registry.pools.push_back(this);
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    ~ObjectPool() {
+        {
+            Registry& registry = GetRegistry();
+            std::lock_guard guard(registry.mutex);
+            registry.pools.erase(std::find(registry.pools.begin(), registry.pools.end(), this));
+        }
+        while (slabs_) {
+            Slab* slab = slabs_;
+            for (size_t i = 0; i < slab->used; ++i) {
+                if (slab->Slots()[i].alive) {
+                    slab->Slots()[i].Object()->~T();
+                }
+            }
+            slabs_ = slab->next;
+            FreeSlab(slab);
+        }
+    }
+
+    template <typename... Args>
+    IntrusivePtr<T> Allocate(Args&&... args) {
+        Magazine& magazine = GetMagazine();
+        if (!magazine.head) {
+            Slot* batch = TakeBatch();
+            if (!batch) {
+                return IntrusivePtr<T>(Construct(std::forward<Args>(args)...));
+            }
+            magazine.head = batch;
+            magazine.size = batch->batch_size;
+        }
+        Slot* slot = magazine.head;
+        magazine.head = slot->next;
+        --magazine.size;
+        available_.fetch_sub(1, std::memory_order_relaxed);
+        return IntrusivePtr<T>(slot->Object());
+    }
+
+    void Release(T* ptr) {
+        Slot* slot = reinterpret_cast<Slot*>(ptr);
+        if (available_.load(std::memory_order_relaxed) >= max_available_) {
+            Destroy(slot);
+            return;
+        }
+        Magazine& magazine = GetMagazine();
+        if (magazine.size == 2 * kBatchSize) {
+            magazine.Flush(kBatchSize, this);
+        }
+        slot->next = magazine.head;
+        magazine.head = slot;
+        ++magazine.size;
+        available_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t NumAvailable() const {
+        return available_.load(std::memory_order_relaxed);
+    }
+
+    size_t NumInUse() const {
+        return constructed_.load(std::memory_order_relaxed) - NumAvailable();
+    }
+
+private:
+    struct Magazine {
+        // Moves `count` slots from the top of the magazine to the depot of `pool`.
+        void Flush(size_t count, ObjectPool* pool) {
+            if (count == 0) {
+                return;
+            }
+            Slot* batch = head;
+            Slot* last = head;
+            for (size_t i = 1; i < count; ++i) {
+                last = last->next;
+            }
+            head = last->next;
+            last->next = nullptr;
+            size -= count;
+            batch->batch_size = count;
+            pool->PutBatches(batch, batch);
+        }
+
+        Slot* head = nullptr;
+        size_t size = 0;
+    };
+
+    struct Registry {
+        ObjectPool* Find(uint64_t id) const {
+            for (ObjectPool* pool : pools) {
+                if (pool->id_ == id) {
+                    return pool;
+                }
+            }
+            return nullptr;
+        }
+
+        std::mutex mutex;
+        std::vector<ObjectPool*> pools;
+    };
+
+    // Magazines of the calling thread. Pools are told apart by ids that are
+    // never reused, so magazines of destroyed pools are simply ignored.
+    struct Cache {
+        struct Entry {
+            uint64_t pool_id;
+            Magazine magazine;
+        };
+
+        // Objects left in the magazines of an exiting thread go to the depots.
+        ~Cache() {
+            Registry& registry = GetRegistry();
+            std::lock_guard guard(registry.mutex);
+            for (Entry& entry : entries) {
+                if (ObjectPool* pool = registry.Find(entry.pool_id)) {
+                    entry.magazine.Flush(entry.magazine.size, pool);
+                }
+            }
+        }
+
+        Magazine& Add(uint64_t pool_id) {
+            Registry& registry = GetRegistry();
+            std::lock_guard guard(registry.mutex);
+            entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                         [&registry](const Entry& entry) {
+                                             return !registry.Find(entry.pool_id);
+                                         }),
+                          entries.end());
+            return entries.emplace_back(Entry{pool_id, Magazine()}).magazine;
+        }
+
+        std::vector<Entry> entries;
+    };
+
+    static Registry& GetRegistry() {
+        static Registry registry;
+        return registry;
+    }
+
+    Magazine& GetMagazine() {
+        static thread_local Cache cache;
+        for (auto& entry : cache.entries) {
+            if (entry.pool_id == id_) {
+                return entry.magazine;
+            }
+        }
+        return cache.Add(id_);
+    }
+
+    // Pushes the batches from `first` to `last`, linked through `next_batch`.
+    void PutBatches(Slot* first, Slot* last) {
+        last->next_batch = depot_.load(std::memory_order_relaxed);
+        while (!depot_.compare_exchange_weak(last->next_batch, first, std::memory_order_release,
+                                             std::memory_order_relaxed)) {
+        }
+    }
+
+    // Takes the whole depot, so that no thread reads slots it does not own,
+    // keeps one batch and puts the rest back.
+    Slot* TakeBatch() {
+        Slot* batch = depot_.exchange(nullptr, std::memory_order_acquire);
+        if (batch && batch->next_batch) {
+            Slot* last = batch->next_batch;
+            while (last->next_batch) {
+                last = last->next_batch;
+            }
+            PutBatches(batch->next_batch, last);
+        }
+        return batch;
+    }
+
+    template <typename... Args>
+    T* Construct(Args&&... args) {
+        Slot* slot;
+        {
+            std::lock_guard guard(mutex_);
+            if (!current_ || current_->used == current_->capacity) {
+                NewSlab();
+            }
+            slot = current_->Slots() + current_->used++;
+            slot->slab = current_;
+            slot->alive = false;
+            current_->live.fetch_add(1, std::memory_order_relaxed);
+        }
+        T* object;
+        try {
+            object = ::new (static_cast<void*>(slot->object)) T(std::forward<Args>(args)...);
+        } catch (...) {
+            Unlink(slot->slab);
+            throw;
+        }
+        slot->alive = true;
+        object->SetHome(this);
+        constructed_.fetch_add(1, std::memory_order_relaxed);
+        return object;
+    }
+
+    void Destroy(Slot* slot) {
+        slot->Object()->~T();
+        slot->alive = false;
+        constructed_.fetch_sub(1, std::memory_order_relaxed);
+        Unlink(slot->slab);
+    }
+
+    // Drops a slot of `slab`, freeing the slab with the last one.
+    void Unlink(Slab* slab) {
+        if (slab->live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard guard(mutex_);
+            Remove(slab);
+        }
+    }
+
+    // Called with `mutex_` held.
+    void NewSlab() {
+        size_t capacity = current_ ? std::min(2 * current_->capacity, kMaxSlabSize) : 1;
+        if (current_ && current_->live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            Remove(current_);
+        }
+        size_t size = kSlotsOffset + capacity * sizeof(Slot);
+        void* memory;
+        if constexpr (kOverAligned) {
+            memory = ::operator new(size, std::align_val_t(alignof(Slot)));
+        } else {
+            memory = ::operator new(size);
+        }
+        auto* slab = ::new (memory) Slab{nullptr, slabs_, capacity, 0, 1};
+        if (slabs_) {
+            slabs_->prev = slab;
+        }
+        slabs_ = slab;
+        current_ = slab;
+    }
+
+    // Called with `mutex_` held.
+    void Remove(Slab* slab) {
+        (slab->prev ? slab->prev->next : slabs_) = slab->next;
+        if (slab->next) {
+            slab->next->prev = slab->prev;
+        }
+        FreeSlab(slab);
+    }
+
+    static void FreeSlab(Slab* slab) {
+        slab->~Slab();
+        if constexpr (kOverAligned) {
+            ::operator delete(slab, std::align_val_t(alignof(Slot)));
+        } else {
+            ::operator delete(slab);
+        }
+    }
+
+    static inline std::atomic<uint64_t> next_id_ = 0;
+
+    const uint64_t id_;
+    const size_t max_available_;
+    std::atomic<Slot*> depot_ = nullptr;
+    std::atomic<size_t> available_ = 0;
+    std::atomic<size_t> constructed_ = 0;
+
+    // Guards the slab list.
+    std::mutex mutex_;
+    Slab* slabs_ = nullptr;
+    Slab* current_ = nullptr;
+};
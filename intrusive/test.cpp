@@ -1,10 +1,14 @@
 #include "intrusive.h"
+#include "object_pool.h"
 
 #include <catch.hpp>
 
 #include "allocations_checker.h"
 
+#include <atomic>
 #include <string>
+#include <thread>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -274,81 +278,6 @@ TEST_CASE("No copies") {
     IntrusivePtr<Pinned> p(new Pinned(1));
 }
 
-template <typename T>
-class ObjectInPool;
-
-template <typename T>
-class ObjectPool {
-    static_assert(std::is_base_of_v<ObjectInPool<T>, T>, "Unsupported type");
-
-public:
-    template <typename... Args>
-    IntrusivePtr<T> Allocate(Args&&... args) {
-        if (!objects_.empty()) {
-            std::unique_ptr<T> ptr = std::move(objects_.back());
-            objects_.pop_back();
-            return IntrusivePtr<T>(ptr.release());
-        }
-        return DoAllocate(std::forward<Args>(args)...);
-    }
-
-    void Release(T* ptr) {
-        objects_.emplace_back(ptr);
-    }
-
-    size_t NumAvailable() const {
-        return objects_.size();
-    }
-
-    size_t NumInUse() const {
-        return allocated_ - NumAvailable();
-    }
-
-private:
-    template <typename... Args>
-    IntrusivePtr<T> DoAllocate(Args&&... args) {
-        ++allocated_;
-        std::unique_ptr<T> object = std::make_unique<T>(std::forward<Args>(args)...);
-        object->SetHome(this);
-        return IntrusivePtr<T>(object.release());
-    }
-
-private:
-    std::vector<std::unique_ptr<T>> objects_;
-    size_t allocated_ = 0;
-};
-
-template <typename Derived>
-class ObjectInPool {
-public:
-    void IncRef() {
-        count_++;
-    }
-
-    void DecRef() {
-        if (--count_ == 0) {
-            TakeMeHome();
-        }
-    }
-
-    size_t RefCount() const {
-        return count_;
-    }
-
-    void SetHome(ObjectPool<Derived>* pool) {
-        home_ = pool;
-    }
-
-private:
-    void TakeMeHome() {
-        home_->Release(static_cast<Derived*>(this));
-    }
-
-private:
-    size_t count_ = 0;
-    ObjectPool<Derived>* home_;
-};
-
 struct PoolableString : ObjectInPool<PoolableString>, std::string {
     using std::string::basic_string;
 };
@@ -397,3 +326,324 @@ TEST_CASE("Object pool") {
         REQUIRE(strs.NumInUse() == 1);
     }
 }
+
+struct PooledBuffer : ObjectInPool<PooledBuffer, AtomicCounter> {
+    PooledBuffer() {
+        ++alive;
+    }
+    ~PooledBuffer() {
+        --alive;
+    }
+
+    std::vector<int> data;
+
+    static inline std::atomic<int> alive = 0;
+};
+
+TEST_CASE("Object pool across threads") {
+    SECTION("Magazines and depot") {
+        constexpr int kNumThreads = 4;
+        {
+            ObjectPool<PooledBuffer> pool;
+            std::vector<std::thread> threads;
+            for (int i = 0; i < kNumThreads; ++i) {
+                threads.emplace_back([&pool] {
+                    std::vector<IntrusivePtr<PooledBuffer>> held;
+                    for (int j = 0; j < 10'000; ++j) {
+                        held.push_back(pool.Allocate());
+                        held.back()->data.assign(4, j);
+                        if (held.size() == 100) {
+                            held.clear();
+                        }
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            REQUIRE(pool.NumInUse() == 0);
+            REQUIRE(pool.NumAvailable() == static_cast<size_t>(PooledBuffer::alive));
+
+            // Objects released by exited threads are reused.
+            int before = PooledBuffer::alive;
+            std::vector<IntrusivePtr<PooledBuffer>> held;
+            for (int i = 0; i < before; ++i) {
+                held.push_back(pool.Allocate());
+            }
+            REQUIRE(PooledBuffer::alive == before);
+            REQUIRE(pool.NumAvailable() == 0);
+            REQUIRE(pool.NumInUse() == static_cast<size_t>(before));
+        }
+        REQUIRE(PooledBuffer::alive == 0);
+    }
+
+    SECTION("Shared objects") {
+        ObjectPool<PooledBuffer> pool;
+        auto buffer = pool.Allocate();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([buffer] {
+                for (int j = 0; j < 10'000; ++j) {
+                    IntrusivePtr<PooledBuffer> copy = buffer;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(buffer.UseCount() == 1);
+        buffer.Reset();
+        REQUIRE(pool.NumAvailable() == 1);
+    }
+
+    SECTION("High-water mark") {
+        ObjectPool<PooledBuffer> pool(2);
+        {
+            std::vector<IntrusivePtr<PooledBuffer>> held;
+            for (int i = 0; i < 300; ++i) {
+                held.push_back(pool.Allocate());
+            }
+            REQUIRE(pool.NumInUse() == 300);
+        }
+        REQUIRE(pool.NumAvailable() == 2);
+        REQUIRE(pool.NumInUse() == 0);
+        REQUIRE(PooledBuffer::alive == 2);
+        auto reused = pool.Allocate();
+        REQUIRE(PooledBuffer::alive == 2);
+    }
+    REQUIRE(PooledBuffer::alive == 0);
+}
+
+struct SharedInt : public AtomicRefCounted<SharedInt> {
+    explicit SharedInt(int value) : value(value) {
+        ++alive;
+    }
+    SharedInt(const SharedInt& other) : AtomicRefCounted<SharedInt>(other), value(other.value) {
+        ++alive;
+    }
+    ~SharedInt() {
+        --alive;
+    }
+
+    int value;
+
+    static inline std::atomic<int> alive = 0;
+};
+
+TEST_CASE("Atomic counter") {
+    SECTION("Single thread") {
+        {
+            auto p = MakeIntrusive<SharedInt>(42);
+            auto q = p;
+            REQUIRE(p.UseCount() == 2);
+            q.Reset();
+            REQUIRE(p.UseCount() == 1);
+            SharedInt copy = *p;
+            REQUIRE(copy.RefCount() == 0);
+        }
+        REQUIRE(SharedInt::alive == 0);
+    }
+
+    SECTION("Threads") {
+        constexpr int kNumThreads = 4;
+        {
+            auto p = MakeIntrusive<SharedInt>(1);
+            std::atomic<bool> same = true;
+            std::vector<std::thread> threads;
+            for (int i = 0; i < kNumThreads; ++i) {
+                threads.emplace_back([p, &same] {
+                    for (int j = 0; j < 100'000; ++j) {
+                        IntrusivePtr<SharedInt> copy = p;
+                        if (copy->value != 1) {
+                            same = false;
+                        }
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            REQUIRE(same);
+            REQUIRE(p.UseCount() == 1);
+        }
+        REQUIRE(SharedInt::alive == 0);
+
+        for (int i = 0; i < 1000; ++i) {
+            std::vector<IntrusivePtr<SharedInt>> copies(kNumThreads, MakeIntrusive<SharedInt>(i));
+            std::vector<std::thread> threads;
+            for (auto& copy : copies) {
+                threads.emplace_back([&copy] { copy.Reset(); });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+        REQUIRE(SharedInt::alive == 0);
+    }
+}
+
+struct Observed : public WeakRefCounted<Observed> {
+    explicit Observed(int value) : value(value) {
+    }
+
+    int value;
+};
+
+TEST_CASE("Weak references") {
+    static_assert(sizeof(WeakRefCounted<Observed>) == sizeof(SimpleCounter));
+
+    SECTION("No table without weak references") {
+        IntrusivePtr<Observed> p;
+        EXPECT_ONE_ALLOCATION(p = MakeIntrusive<Observed>(1));
+        auto q = p;
+        REQUIRE(p.UseCount() == 2);
+    }
+
+    SECTION("Lock and expire") {
+        IntrusiveWeakPtr<Observed> weak;
+        {
+            auto p = MakeIntrusive<Observed>(42);
+            auto copy = p;
+            EXPECT_ONE_ALLOCATION(weak = p);
+            REQUIRE(p.UseCount() == 2);
+            REQUIRE(weak.UseCount() == 2);
+            auto locked = weak.Lock();
+            REQUIRE(locked->value == 42);
+            REQUIRE(p.UseCount() == 3);
+            IntrusiveWeakPtr<Observed> second = copy;
+            REQUIRE(!second.Expired());
+        }
+        REQUIRE(weak.Expired());
+        REQUIRE(!weak.Lock());
+        weak.Reset();
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Table outlives object and vice versa") {
+        auto p = MakeIntrusive<Observed>(1);
+        {
+            IntrusiveWeakPtr<Observed> weak = p;
+            IntrusiveWeakPtr<Observed> moved = std::move(weak);
+            REQUIRE(weak.Expired());
+            REQUIRE(moved.Lock().Get() == p.Get());
+        }
+        REQUIRE(p.UseCount() == 1);
+        IntrusiveWeakPtr<Observed> weak = p;
+        p.Reset();
+        IntrusiveWeakPtr<Observed> copy = weak;
+        REQUIRE(copy.Expired());
+    }
+}
+
+TEST_CASE("Immortal objects") {
+    SECTION("Counts stop changing") {
+        // Immortal objects are never freed, keep this one reachable.
+        static auto* config = new SharedInt(7);
+        config->IncRef();
+        config->MakeImmortal();
+        size_t count = config->RefCount();
+        {
+            IntrusivePtr<SharedInt> p(config);
+            auto q = p;
+            REQUIRE(p.UseCount() == count);
+        }
+        config->DecRef();
+        REQUIRE(config->RefCount() == count);
+        REQUIRE(config->value == 7);
+    }
+
+    SECTION("Shared between threads") {
+        static auto* config = new SharedInt(1);
+        IntrusivePtr<SharedInt> p(config);
+        p->MakeImmortal();
+        std::atomic<bool> same = true;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([p, &same] {
+                for (int j = 0; j < 100'000; ++j) {
+                    IntrusivePtr<SharedInt> copy = p;
+                    if (copy->value != 1) {
+                        same = false;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(same);
+        size_t count = p.UseCount();
+        p.Reset();
+        REQUIRE(config->RefCount() == count);
+    }
+
+    SECTION("Saturation") {
+        SimpleCounter counter;
+        counter.MakeImmortal();
+        REQUIRE(counter.DecRef() == kImmortalRefCount);
+        REQUIRE(counter.IncRef() == kImmortalRefCount);
+    }
+}
+
+struct Token : RefCounted<Token, Counter16, DefaultDelete> {
+    explicit Token(uint16_t kind) : kind(kind) {
+    }
+
+    uint16_t kind;
+    uint32_t offset = 0;
+};
+
+// The counter fills the gap between `id` and `next`.
+struct GraphNode : RefCounted<GraphNode, EmbeddedCounter<Counter32>, DefaultDelete> {
+    explicit GraphNode(uint32_t id) : id(id) {
+    }
+
+    friend Counter32& RefCounterOf(GraphNode& node) {
+        return node.refs;
+    }
+
+    uint32_t id;
+    Counter32 refs;
+    IntrusivePtr<GraphNode> next;
+};
+
+TEST_CASE("Counter width") {
+    SECTION("Sizes") {
+        static_assert(sizeof(Counter8) == 1);
+        static_assert(sizeof(Counter16) == 2);
+        static_assert(sizeof(Counter32) == 4);
+        static_assert(sizeof(Token) == 8);
+        static_assert(sizeof(GraphNode) == 2 * sizeof(void*));
+    }
+
+    SECTION("Narrow counter") {
+        auto token = MakeIntrusive<Token>(3);
+        std::vector<IntrusivePtr<Token>> copies(1000, token);
+        REQUIRE(token.UseCount() == 1001);
+        copies.clear();
+        REQUIRE(token.UseCount() == 1);
+
+        Token copy = *token;
+        REQUIRE(copy.RefCount() == 0);
+        REQUIRE(copy.kind == 3);
+    }
+
+    SECTION("Embedded counter") {
+        auto first = MakeIntrusive<GraphNode>(1);
+        first->next = MakeIntrusive<GraphNode>(2);
+        IntrusivePtr<GraphNode> second = first->next;
+        REQUIRE(first.UseCount() == 1);
+        REQUIRE(second.UseCount() == 2);
+        REQUIRE(second->refs.RefCount() == 2);
+        first.Reset();
+        REQUIRE(second.UseCount() == 1);
+        REQUIRE(second->id == 2);
+    }
+
+    SECTION("Saturation") {
+        Counter8 counter;
+        counter.MakeImmortal();
+        REQUIRE(counter.IncRef() == Counter8::kImmortal);
+        REQUIRE(counter.DecRef() == Counter8::kImmortal);
+    }
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+#include <cstdint>
+
+// Keeps a pointer that is not the object of its own block (an aliasing or a
+// converted pointer) so that `AtomicSharedPtr` can recover it from a block.
+template <typename T>
+class AliasConterBlock : public ManagedBlock<AliasConterBlock<T>, AtomicPolicy> {
+public:
+    explicit AliasConterBlock(SharedPtr<T, AtomicPolicy> source)
+        : ptr_(source.Get()), source_(std::move(source)) {
+    }
+
+private:
+    friend class ManagedBlock<AliasConterBlock, AtomicPolicy>;
+
+    void DestroyObject() {
+        source_.Reset();
+    }
+    void FreeBlock() {
+        delete this;
+    }
+    void* OwnedObject() {
+        return const_cast<std::remove_cv_t<T>*>(ptr_);
+    }
+
+    T* ptr_;
+    SharedPtr<T, AtomicPolicy> source_;
+};
+
+// `SharedPtr` that may be loaded and replaced concurrently without locks.
+//
+// The block pointer is packed with a count of loads in flight into one word.
+// A reader first reserves the block by bumping that count, then takes a real
+// reference and gives the reservation back. A writer that replaces the block
+// credits the reservations it has swapped out to the block, and the readers
+// that find their block gone drop the credit instead.
+//
+// Relies on user-space pointers fitting in 48 bits (x86-64, AArch64) and on
+// fewer than 65536 concurrent loads of the same `AtomicSharedPtr`.
+template <typename T>
+class AtomicSharedPtr {
+    using Block = ControlBlockBase<AtomicPolicy>;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    AtomicSharedPtr() : word_(0) {
+    }
+    AtomicSharedPtr(SharedPtr<T, AtomicPolicy> desired) : word_(Pack(Detach(std::move(desired)))) {
+    }
+
+    AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+    AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~AtomicSharedPtr() {
+        Adopt(word_.load(std::memory_order_acquire));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Operations
+
+    SharedPtr<T, AtomicPolicy> Load() const {
+        SharedPtr<T, AtomicPolicy> result;
+        uint64_t word = word_.fetch_add(kLoadOne, std::memory_order_acquire);
+        Block* block = GetBlock(word);
+        if (block) {
+            block->Increment();
+            result.Set(static_cast<T*>(block->Object()));
+            result.SetBlock(block);
+        }
+        Unreserve(block);
+        return result;
+    }
+
+    void Store(SharedPtr<T, AtomicPolicy> desired) {
+        Exchange(std::move(desired));
+    }
+
+    SharedPtr<T, AtomicPolicy> Exchange(SharedPtr<T, AtomicPolicy> desired) {
+        uint64_t desired_word = Pack(Detach(std::move(desired)));
+        return Adopt(word_.exchange(desired_word, std::memory_order_acq_rel));
+    }
+
+    // Replaces the value if it is `expected`, otherwise loads it into `expected`.
+    bool CompareExchange(SharedPtr<T, AtomicPolicy>& expected, SharedPtr<T, AtomicPolicy> desired) {
+        uint64_t desired_word = Pack(Detach(std::move(desired)));
+        uint64_t word = word_.load(std::memory_order_relaxed);
+        while (true) {
+            Block* block = GetBlock(word);
+            if (block != expected.GetBlock() ||
+                (block && static_cast<T*>(block->Object()) != expected.Get())) {
+                Adopt(desired_word);
+                expected = Load();
+                return false;
+            }
+            if (word_.compare_exchange_weak(word, desired_word, std::memory_order_acq_rel,
+                                            std::memory_order_relaxed)) {
+                Adopt(word);
+                return true;
+            }
+        }
+    }
+
+    bool IsLockFree() const {
+        return word_.is_lock_free();
+    }
+
+private:
+    static constexpr int kLoadShift = 48;
+    static constexpr uint64_t kLoadOne = uint64_t(1) << kLoadShift;
+    static constexpr uint64_t kBlockMask = kLoadOne - 1;
+
+    static_assert(sizeof(void*) == sizeof(uint64_t), "AtomicSharedPtr needs 64-bit pointers");
+
+    static Block* GetBlock(uint64_t word) {
+        return reinterpret_cast<Block*>(word & kBlockMask);
+    }
+    static uint64_t Pack(Block* block) {
+        return reinterpret_cast<uint64_t>(block);
+    }
+
+    // Takes over the reference of `desired`, wrapping it if its pointer is not
+    // the object of its block.
+    static Block* Detach(SharedPtr<T, AtomicPolicy> desired) {
+        static_assert(!kRefCounted<T>, "RefCounted objects have no control block");
+        Block* block = desired.GetBlock();
+        if (!block) {
+            return nullptr;
+        }
+        if (block->Object() != const_cast<std::remove_cv_t<T>*>(desired.Get())) {
+            return new AliasConterBlock<T>(std::move(desired));
+        }
+        desired.Set(nullptr);
+        desired.SetBlock(nullptr);
+        return block;
+    }
+
+    // Turns the reference held by a swapped out word back into a `SharedPtr`,
+    // crediting the block with the loads still in flight.
+    static SharedPtr<T, AtomicPolicy> Adopt(uint64_t word) {
+        SharedPtr<T, AtomicPolicy> result;
+        Block* block = GetBlock(word);
+        if (block) {
+            if (int loads = static_cast<int>(word >> kLoadShift)) {
+                block->Increment(loads);
+            }
+            result.Set(static_cast<T*>(block->Object()));
+            result.SetBlock(block);
+        }
+        return result;
+    }
+
+    void Unreserve(Block* block) const {
+        uint64_t word = word_.load(std::memory_order_relaxed);
+        while (GetBlock(word) == block && (word >> kLoadShift) != 0) {
+            if (word_.compare_exchange_weak(word, word - kLoadOne, std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        // The block was swapped out and our reservation was credited to it.
+        if (block) {
+            SharedPtr<T, AtomicPolicy> credit;
+            credit.SetBlock(block);
+        }
+    }
+
+    mutable std::atomic<uint64_t> word_;
+};
@@ -0,0 +1,238 @@
+#include "atomic_shared.h"
+#include "shared.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr auto kDuration = std::chrono::milliseconds(500);
+
+// Runs `reader` on `num_threads` threads for `kDuration` while the calling
+// thread runs `writer`, and returns reader operations per second.
+template <typename Reader, typename Writer>
+double MeasureContended(int num_threads, Reader reader, Writer writer) {
+    std::atomic<bool> stop = false;
+    std::atomic<long long> total = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back([&] {
+            long long ops = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                reader();
+                ++ops;
+            }
+            total += ops;
+        });
+    }
+    auto start = Clock::now();
+    while (Clock::now() - start < kDuration) {
+        writer();
+    }
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    return total / elapsed.count();
+}
+
+void BenchAtomicSharedPtr() {
+    std::printf("AtomicSharedPtr vs mutex-guarded SharedPtr, loads/s (one writer)\n");
+    for (int num_threads : {1, 2, 4, 8}) {
+        AtomicSharedPtr<int> atomic(MakeShared<int, AtomicPolicy>(0));
+        double lock_free = MeasureContended(
+            num_threads, [&] { atomic.Load(); },
+            [&] {
+                atomic.Store(MakeShared<int, AtomicPolicy>(1));
+                std::this_thread::yield();
+            });
+
+        std::mutex mutex;
+        SharedPtr<int, AtomicPolicy> guarded = MakeShared<int, AtomicPolicy>(0);
+        double locked = MeasureContended(
+            num_threads,
+            [&] {
+                std::unique_lock lock(mutex);
+                auto copy = guarded;
+                lock.unlock();
+            },
+            [&] {
+                auto desired = MakeShared<int, AtomicPolicy>(1);
+                {
+                    std::lock_guard lock(mutex);
+                    guarded.Swap(desired);
+                }
+                std::this_thread::yield();
+            });
+
+        std::printf("  %d readers: atomic %12.0f  mutex %12.0f\n", num_threads, lock_free, locked);
+    }
+}
+
+// Allocates a buffer and overwrites it, as a `read()` into it would.
+template <typename Make>
+double MeasureOverwrite(size_t size, Make make) {
+    constexpr int kIterations = 200;
+    auto start = Clock::now();
+    for (int i = 0; i < kIterations; ++i) {
+        SharedPtr<std::byte[]> buffer = make(size);
+        std::memset(buffer.Get(), i, size);
+        // Keep the stores alive.
+        volatile std::byte sink = buffer[size - 1];
+        (void)sink;
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    return elapsed.count() / kIterations * 1e6;
+}
+
+void BenchForOverwrite() {
+    std::printf("MakeShared vs MakeSharedForOverwrite, us per allocated and overwritten buffer\n");
+    for (size_t mib : {1, 4, 16, 64}) {
+        size_t size = mib << 20;
+        double zeroed = MeasureOverwrite(size, [](size_t n) { return MakeShared<std::byte[]>(n); });
+        double overwrite = MeasureOverwrite(
+            size, [](size_t n) { return MakeSharedForOverwrite<std::byte[]>(n); });
+        std::printf("  %3zu MiB: value-init %10.1f  for overwrite %10.1f\n", mib, zeroed, overwrite);
+    }
+}
+
+struct Hot {
+    std::atomic<long long> value = 0;
+};
+
+// Readers copy the pointer, which writes the counters, while the writer
+// updates the object. Unpadded, both land on the same cache line.
+template <typename Make>
+double MeasureFalseSharing(int num_threads, Make make) {
+    SharedPtr<Hot, AtomicPolicy> hot = make();
+    return MeasureContended(
+        num_threads, [&] { SharedPtr<Hot, AtomicPolicy> copy = hot; },
+        [&] { hot->value.fetch_add(1, std::memory_order_relaxed); });
+}
+
+void BenchPadded() {
+    std::printf("MakeShared vs MakeSharedPadded, pointer copies/s while the object is written\n");
+    for (int num_threads : {1, 2, 4, 8}) {
+        double shared = MeasureFalseSharing(num_threads, [] { return MakeShared<Hot, AtomicPolicy>(); });
+        double padded =
+            MeasureFalseSharing(num_threads, [] { return MakeSharedPadded<Hot, AtomicPolicy>(); });
+        std::printf("  %d readers: same line %12.0f  padded %12.0f\n", num_threads, shared, padded);
+    }
+}
+
+struct Node {
+    long long value;
+    long long payload[3];
+};
+
+// Builds `count` nodes with `make`, then sums them; returns ns per node for each phase.
+template <typename Make>
+std::pair<double, double> MeasureNodes(size_t count, Make make) {
+    auto start = Clock::now();
+    std::vector<SharedPtr<Node>> nodes = make(count);
+    auto built = Clock::now();
+    long long sum = 0;
+    for (int pass = 0; pass < 10; ++pass) {
+        for (const auto& node : nodes) {
+            sum += node->value;
+        }
+    }
+    auto summed = Clock::now();
+    volatile long long sink = sum;
+    (void)sink;
+    std::chrono::duration<double, std::nano> build = built - start;
+    std::chrono::duration<double, std::nano> traverse = summed - built;
+    return {build.count() / count, traverse.count() / count / 10};
+}
+
+void BenchBatch() {
+    constexpr size_t kCount = 1'000'000;
+    std::printf("MakeShared vs MakeSharedBatch, ns per node for %zu nodes\n", kCount);
+    auto [single_build, single_traverse] = MeasureNodes(kCount, [](size_t count) {
+        std::vector<SharedPtr<Node>> nodes;
+        nodes.reserve(count);
+        // Interleave with short-lived allocations, as a loader parsing input would.
+        std::vector<SharedPtr<std::string>> garbage;
+        for (size_t i = 0; i < count; ++i) {
+            nodes.push_back(MakeShared<Node>(Node{static_cast<long long>(i), {}}));
+            if (i % 2 == 0) {
+                garbage.push_back(MakeShared<std::string>(40, 'x'));
+            }
+        }
+        return nodes;
+    });
+    auto [batch_build, batch_traverse] = MeasureNodes(kCount, [](size_t count) {
+        return MakeSharedBatch<Node>(count,
+                                     [](size_t i) { return Node{static_cast<long long>(i), {}}; });
+    });
+    std::printf("  build: single %.1f  batch %.1f\n", single_build, batch_build);
+    std::printf("  traverse: single %.2f  batch %.2f\n", single_traverse, batch_traverse);
+}
+
+struct Widget : EnableSharedFromThis<Widget> {
+    int value = 0;
+};
+
+// Nanoseconds per call of `op`.
+template <typename Op>
+double MeasureSingle(Op op) {
+    constexpr int kIterations = 10'000'000;
+    auto start = Clock::now();
+    for (int i = 0; i < kIterations; ++i) {
+        op();
+    }
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+    return elapsed.count() / kIterations;
+}
+
+void BenchSharedFromThis() {
+    std::printf("EnableSharedFromThis: %zu bytes per object\n", sizeof(EnableSharedFromThis<Widget>));
+    double make = MeasureSingle([] { MakeShared<Widget>()->value++; });
+    SharedPtr<Widget> widget = MakeShared<Widget>();
+    double from_this = MeasureSingle([&] { widget->SharedFromThis()->value++; });
+    double copy = MeasureSingle([&] { SharedPtr<Widget>(widget)->value++; });
+    std::printf("  ns per MakeShared %.1f  SharedFromThis %.1f  copy %.1f\n", make, from_this, copy);
+}
+
+struct Message {
+    int id;
+    char body[120];
+};
+
+void BenchRecycling() {
+    std::printf("MakeShared vs RecyclingMakeShared, ns per message (64 in flight)\n");
+    std::vector<SharedPtr<Message>> window(64);
+    size_t slot = 0;
+    double plain = MeasureSingle([&] {
+        window[slot++ % window.size()] = MakeShared<Message>();
+    });
+    double recycled = MeasureSingle([&] {
+        window[slot++ % window.size()] = RecyclingMakeShared<Message>();
+    });
+    PoolStats stats = RecyclingStats<Message>();
+    std::printf("  plain %.1f  recycled %.1f  hit rate %.4f\n", plain, recycled,
+                static_cast<double>(stats.hits) / (stats.hits + stats.misses));
+}
+
+}  // namespace
+
+int main() {
+    BenchAtomicSharedPtr();
+    BenchForOverwrite();
+    BenchSharedFromThis();
+    BenchPadded();
+    BenchBatch();
+    BenchRecycling();
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+struct PoolStats {
+    size_t hits = 0;    // Served from a free list.
+    size_t misses = 0;  // Went to `operator new`.
+};
+
+// Free list allocator for fixed-size chunks of `kSize` bytes.
+//
+// Every thread keeps a magazine of free chunks and touches no shared state
+// while it neither runs dry nor overflows. Overflowing magazines hand a batch
+// of chunks to a global depot, and empty ones refill from it before falling
+// back to `operator new`. Memory is never returned to the system.
+//
+// `Tag` gives a separate pool (and separate stats) to chunks of the same size.
+template <size_t kSize, typename Tag = void>
+class FreeListPool {
+    struct Node {
+        Node* next;
+        // Set in the first node of a batch inside the depot.
+        Node* next_batch;
+        size_t batch_size;
+    };
+
+    static_assert(kSize >= sizeof(Node) && kSize % alignof(Node) == 0);
+
+public:
+    static constexpr size_t kBatchSize = 64;
+
+    static void* Allocate() {
+        Magazine& magazine = GetMagazine();
+        if (!magazine.head) {
+            Node* batch = GetDepot().Take();
+            if (!batch) {
+                ++magazine.stats.misses;
+                return ::operator new(kSize);
+            }
+            magazine.head = batch;
+            magazine.size = batch->batch_size;
+        }
+        ++magazine.stats.hits;
+        Node* node = magazine.head;
+        magazine.head = node->next;
+        --magazine.size;
+        return node;
+    }
+
+    static void Deallocate(void* ptr) {
+        Magazine& magazine = GetMagazine();
+        if (magazine.size == 2 * kBatchSize) {
+            magazine.Flush(kBatchSize);
+        }
+        auto* node = static_cast<Node*>(ptr);
+        node->next = magazine.head;
+        magazine.head = node;
+        ++magazine.size;
+    }
+
+    // Stats of the calling thread.
+    static PoolStats Stats() {
+        return GetMagazine().stats;
+    }
+
+private:
+    struct Depot {
+        // Takes a whole batch, returns nullptr if there is none.
+        Node* Take() {
+            std::lock_guard guard(mutex);
+            Node* batch = batches;
+            if (batch) {
+                batches = batch->next_batch;
+            }
+            return batch;
+        }
+        void Put(Node* batch) {
+            std::lock_guard guard(mutex);
+            batch->next_batch = batches;
+            batches = batch;
+        }
+
+        std::mutex mutex;
+        Node* batches = nullptr;
+    };
+
+    struct Magazine {
+        ~Magazine() {
+            Flush(size);
+        }
+
+        // Moves `count` chunks from the top of the magazine to the depot.
+        void Flush(size_t count) {
+            if (count == 0) {
+                return;
+            }
+            Node* batch = head;
+            Node* last = head;
+            for (size_t i = 1; i < count; ++i) {
+                last = last->next;
+            }
+            head = last->next;
+            last->next = nullptr;
+            size -= count;
+            batch->batch_size = count;
+            GetDepot().Put(batch);
+        }
+
+        Node* head = nullptr;
+        size_t size = 0;
+        PoolStats stats;
+    };
+
+    static Magazine& GetMagazine() {
+        static thread_local Magazine magazine;
+        return magazine;
+    }
+    static Depot& GetDepot() {
+        static Depot depot;
+        return depot;
+    }
+};
+
+constexpr size_t kPoolSizeClass = 16;
+constexpr size_t kPoolMaxSize = 256;
+
+constexpr size_t PoolSizeClass(size_t size) {
+    size = (size + kPoolSizeClass - 1) / kPoolSizeClass * kPoolSizeClass;
+    return size < 2 * kPoolSizeClass ? 2 * kPoolSizeClass : size;
+}
+
+// Pool shared by all control blocks of the same size class.
+template <typename Block>
+using ControlBlockPool = FreeListPool<PoolSizeClass(sizeof(Block))>;
+
+// Whether blocks of this type can be placed in a `ControlBlockPool`.
+template <typename Block>
+constexpr bool kPoolable = sizeof(Block) <= kPoolMaxSize &&
+                           alignof(Block) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+// A pool of its own for every recycled block type, which keeps the stats per type.
+template <typename Block>
+using RecyclingPool = FreeListPool<PoolSizeClass(sizeof(Block)), Block>;
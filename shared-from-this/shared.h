@@ -3,35 +3,102 @@
 #include "sw_fwd.h"
 #include "weak.h"
 #include <cstddef>
-class ESFTBase {};
-template <typename T>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Whether `Base*` can be downcast to `Derived*` with `static_cast`, which is not
+// the case for a virtual base.
+template <typename Derived, typename Base, typename = void>
+constexpr bool kStaticDowncast = false;
+template <typename Derived, typename Base>
+constexpr bool kStaticDowncast<Derived, Base,
+                               std::void_t<decltype(static_cast<Derived*>(std::declval<Base*>()))>> =
+    true;
+
+// Keeps a plain pointer to the control block instead of a `WeakPtr`: the block
+// outlives the object, and a block whose deleter may keep the object alive
+// clears the pointer before calling it, so the pointer stays valid as long as
+// `this` does.
+template <typename T, typename Policy = SingleThreadedPolicy>
 class EnableSharedFromThis : public ESFTBase {
+    using Block = ControlBlockBase<Policy>;
+
 public:
-    SharedPtr<T> SharedFromThis() {
-        return selfweak_.Lock();
+    // Returns an empty pointer if the object is not owned by a `SharedPtr`.
+    SharedPtr<T, Policy> SharedFromThis() {
+        SharedPtr<T, Policy> result;
+        Block* block = GetSelfBlock();
+        if (block && block->IncrementIfNotZero()) {
+            result.Set(Self());
+            result.SetBlock(block);
+        }
+        return result;
     }
-    SharedPtr<const T> SharedFromThis() const {
-        return selfweak_.Lock();
+    SharedPtr<const T, Policy> SharedFromThis() const {
+        return const_cast<EnableSharedFromThis*>(this)->SharedFromThis();
     }
 
-    WeakPtr<T> WeakFromThis() noexcept {
-        return selfweak_;
+    WeakPtr<T, Policy> WeakFromThis() noexcept {
+        Block* block = GetSelfBlock();
+        return WeakPtr<T, Policy>(block ? Self() : nullptr, block);
     }
-    WeakPtr<const T> WeakFromThis() const noexcept {
-        return WeakPtr<const T>(selfweak_);
+    WeakPtr<const T, Policy> WeakFromThis() const noexcept {
+        return const_cast<EnableSharedFromThis*>(this)->WeakFromThis();
     }
     bool Check() {
-        return !selfweak_.Expired();
+        Block* block = GetSelfBlock();
+        return block && block->Get1() != 0;
     }
 
 private:
-    WeakPtr<T> selfweak_;
-    template <typename U>
+    template <typename U, typename P>
     friend class SharedPtr;
+
+    // A non-virtual base keeps the block pointer as is. A virtual one packs the
+    // distance from `T` to this base in words into the upper 16 bits, so it
+    // needs a block pointer that fits in 48 bits: no tags (TBI, MTE, LAM) and
+    // no 5-level paging. With any other block the object finds no owners.
+    static constexpr int kOffsetShift = 48;
+    static constexpr uint64_t kBlockMask = (uint64_t(1) << kOffsetShift) - 1;
+
+    void SetSelf(T* self, Block* block) {
+        auto block_bits = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(block));
+        if constexpr (kStaticDowncast<T, EnableSharedFromThis>) {
+            self_ = block_bits;
+        } else {
+            auto offset = (reinterpret_cast<std::byte*>(this) - reinterpret_cast<std::byte*>(self)) /
+                          static_cast<ptrdiff_t>(alignof(EnableSharedFromThis));
+            // As do objects too large for the offset.
+            if ((block_bits & ~kBlockMask) == 0 && offset >= 0 && offset < (1 << 16)) {
+                self_ = block_bits | static_cast<uint64_t>(offset) << kOffsetShift;
+            }
+        }
+    }
+    Block* GetSelfBlock() const {
+        if constexpr (kStaticDowncast<T, EnableSharedFromThis>) {
+            return reinterpret_cast<Block*>(static_cast<uintptr_t>(self_));
+        } else {
+            return reinterpret_cast<Block*>(static_cast<uintptr_t>(self_ & kBlockMask));
+        }
+    }
+    T* Self() {
+        if constexpr (kStaticDowncast<T, EnableSharedFromThis>) {
+            return static_cast<T*>(this);
+        } else {
+            auto offset = static_cast<ptrdiff_t>(self_ >> kOffsetShift) *
+                          static_cast<ptrdiff_t>(alignof(EnableSharedFromThis));
+            return reinterpret_cast<T*>(reinterpret_cast<std::byte*>(this) - offset);
+        }
+    }
 };
-template <typename T>
+
+template <typename T, typename Policy>
 class SharedPtr {
 public:
+    // `T` itself, or the element type of `SharedPtr<T[]>`.
+    using ElementType = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -40,33 +107,37 @@ public:
     SharedPtr(std::nullptr_t) : ptr_(nullptr), block_(nullptr) {
     }
 
-    explicit SharedPtr(T* ptr) : ptr_(ptr), block_(nullptr) {
-        if (ptr_) {
-
-            block_ = new PointingConterBlock<T>(ptr_);
-            block_->Increment();
-        }
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            ptr->selfweak_ = *this;
+    template <typename U, typename = std::enable_if_t<IsAdoptable<U, T>::value>>
+    explicit SharedPtr(U* ptr) : ptr_(ptr), block_(nullptr) {
+        // A `RefCounted` object behind a plain base gets a block of its own.
+        if constexpr (kRefCounted<ElementType>) {
+            AddRef();
+        } else if (ptr_) {
+            DefaultDeleter deleter;
+            Adopt(ptr, deleter);
         }
     }
-    template <typename U>
-    explicit SharedPtr(U* ptr) : ptr_(ptr), block_(nullptr) {
-
+    template <typename U, typename Deleter,
+              typename = std::enable_if_t<IsAdoptable<U, T>::value &&
+                                          !std::is_convertible_v<Deleter, ControlBlockBase<Policy>*>>>
+    SharedPtr(U* ptr, Deleter deleter) : ptr_(ptr), block_(nullptr) {
+        static_assert(!kRefCounted<ElementType>,
+                      "RefCounted objects are destroyed by their own Deleter");
         if (ptr_) {
-            block_ = new PointingConterBlock<U>(ptr);
-            block_->Increment();
-        }
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            ptr->selfweak_ = *this;
+            Adopt(ptr, deleter);
         }
     }
+    // Like `std::shared_ptr`, owns no object, but `deleter(nullptr)` runs
+    // after the last owner.
+    template <typename Deleter,
+              typename = std::enable_if_t<!std::is_convertible_v<Deleter, ControlBlockBase<Policy>*>>>
+    SharedPtr(std::nullptr_t, Deleter deleter) : ptr_(nullptr), block_(nullptr) {
+        Adopt(ptr_, deleter);
+    }
     void Check() const {
     }
     SharedPtr(const SharedPtr& other) : ptr_(other.ptr_), block_(other.block_) {
-        if (block_) {
-            block_->Increment();
-        }
+        AddRef();
     }
 
     SharedPtr(SharedPtr&& other) noexcept : ptr_(other.ptr_), block_(other.block_) {
@@ -74,71 +145,74 @@ public:
         other.block_ = nullptr;
     }
 
-    SharedPtr(T* ptr, ControlBlockBase* block) : ptr_(ptr), block_(block) {
+    SharedPtr(ElementType* ptr, ControlBlockBase<Policy>* block) : ptr_(ptr), block_(block) {
+        static_assert(!kRefCounted<ElementType>, "RefCounted objects have no control block");
         if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            ptr->selfweak_ = *this;
+            ptr->SetSelf(ptr, block_);
         }
     }
 
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) : ptr_(ptr), block_(other.GetBlock()) {
-        if (block_) {
-            block_->Increment();
-        }
+    SharedPtr(const SharedPtr<Y, Policy>& other, ElementType* ptr) : ptr_(ptr), block_(other.GetBlock()) {
+        static_assert(!kRefCounted<std::remove_extent_t<Y>> && !kRefCounted<ElementType>,
+                      "RefCounted objects can't be aliased");
+        AddRef();
     }
 
-    template <typename U>
-    SharedPtr(SharedPtr<U>&& other) noexcept : ptr_(other.Get()), block_(other.GetBlock()) {
+    template <typename U, typename = std::enable_if_t<kCompatiblePtr<U, T>>>
+    SharedPtr(SharedPtr<U, Policy>&& other) noexcept : ptr_(other.Get()), block_(other.GetBlock()) {
+        static_assert(kSameCounter<U>);
         other.Set(nullptr);
         other.SetBlock(nullptr);
     }
 
-    void Set(T* ptr) {
+    void Set(ElementType* ptr) {
         ptr_ = ptr;
     }
-    void SetBlock(ControlBlockBase* block) {
+    void SetBlock(ControlBlockBase<Policy>* block) {
         block_ = block;
     }
-    explicit SharedPtr(const WeakPtr<T>& other) : ptr_(nullptr), block_(nullptr) {
-        if (other.Expired()) {
-            throw BadWeakPtr();
-        }
-        if (!other.Expired()) {
-            block_ = other.GetBlock();
-            block_->Increment();
-            ptr_ = other.Get();
-        } else {
-
+    // A template, so that policies without weak counts never instantiate `WeakPtr`.
+    template <typename P, typename = std::enable_if_t<std::is_same_v<P, Policy>>>
+    explicit SharedPtr(const WeakPtr<T, P>& other) : ptr_(nullptr), block_(nullptr) {
+        if (!other.GetBlock() || !other.GetBlock()->IncrementIfNotZero()) {
             throw BadWeakPtr();
         }
+        block_ = other.GetBlock();
+        ptr_ = other.Get();
     }
+    template <typename U, typename = std::enable_if_t<kCompatiblePtr<U, T>>>
+    SharedPtr(const SharedPtr<U, Policy>& other) : ptr_(other.Get()), block_(other.GetBlock()) {
+        static_assert(kSameCounter<U>);
+        AddRef();
+    }
+    // Shares the counter of an `IntrusivePtr` during a migration between the two.
     template <typename U>
-    SharedPtr(const SharedPtr<U>& other) : ptr_(other.Get()), block_(other.GetBlock()) {
-        if (block_) {
-            block_->Increment();
-        }
+    SharedPtr(const IntrusivePtr<U>& other) : ptr_(other.Get()), block_(nullptr) {
+        static_assert(kRefCounted<ElementType>);
+        AddRef();
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // `operator=`-s
 
-    template <typename U>
-    SharedPtr& operator=(const SharedPtr<U>& other) {
+    template <typename U, typename = std::enable_if_t<kCompatiblePtr<U, T>>>
+    SharedPtr& operator=(const SharedPtr<U, Policy>& other) {
+        static_assert(kSameCounter<U>);
         if (this->Get() != other.Get()) {
             Reset();
             block_ = other.GetBlock();
             ptr_ = other.Get();
-            if (block_) {
-                block_->Increment();
-            }
+            AddRef();
         }
         return *this;
     }
 
-    template <typename U>
-    SharedPtr& operator=(SharedPtr<U>&& other) noexcept {
+    template <typename U, typename = std::enable_if_t<kCompatiblePtr<U, T>>>
+    SharedPtr& operator=(SharedPtr<U, Policy>&& other) noexcept {
+        static_assert(kSameCounter<U>);
         if (this->Get() != other.Get()) {
             Reset();
             ptr_ = other.Get();
@@ -154,9 +228,7 @@ public:
             Reset();
             block_ = other.block_;
             ptr_ = other.ptr_;
-            if (block_) {
-                block_->Increment();
-            }
+            AddRef();
         }
         return *this;
     }
@@ -183,53 +255,44 @@ public:
     // Modifiers
 
     void Reset() {
-        if (block_) {
-            block_->Decrement();
-            if (block_->Get1() == 0) {
-                if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-                    block_->IncrementWeak();
-                }
+        if constexpr (kRefCounted<ElementType>) {
+            if (ptr_) {
+                Counted(std::exchange(ptr_, nullptr))->DecRef();
+            }
+        } else if (block_) {
+            DecrementResult result = block_->Decrement();
+            if (result == DecrementResult::kLast) {
+                block_->DestroyAndDeallocate();
+            } else if (result == DecrementResult::kExpired) {
                 block_->Destroy();
-                if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-                    block_->DecrementWeak();
-                }
                 Realise();
             }
             block_ = nullptr;
             ptr_ = nullptr;
         }
     }
+    // Drops the weak reference held on behalf of the strong owners.
     void Realise() const {
-        if (block_->Get1() + block_->Get2() == 0) {
-            delete block_;
+        // Without weak counts `Decrement()` reports the last owner only.
+        if constexpr (kCountsWeak<Policy>) {
+            if (block_->DecrementWeak()) {
+                block_->Deallocate();
+            }
         }
     }
 
-    ControlBlockBase* GetBlock() const {
+    ControlBlockBase<Policy>* GetBlock() const {
         return block_;
     }
 
-    void Reset(T* ptr) {
-        Reset();
-        if (ptr) {
-            block_ = new PointingConterBlock<T>(ptr);
-            block_->Increment();
-        } else {
-            block_ = nullptr;
-        }
-        ptr_ = ptr;
+    template <typename U, typename = std::enable_if_t<IsAdoptable<U, T>::value>>
+    void Reset(U* ptr) {
+        SharedPtr(ptr).Swap(*this);
     }
 
-    template <typename U>
-    void Reset(U* ptr) {
-        Reset();
-        if (ptr) {
-            block_ = new PointingConterBlock<U>(ptr);
-            block_->Increment();
-        } else {
-            block_ = nullptr;
-        }
-        ptr_ = ptr;
+    template <typename U, typename Deleter, typename = std::enable_if_t<IsAdoptable<U, T>::value>>
+    void Reset(U* ptr, Deleter deleter) {
+        SharedPtr(ptr, std::move(deleter)).Swap(*this);
     }
 
     void Swap(SharedPtr& other) {
@@ -240,29 +303,80 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
-    T* Get() const {
+    ElementType* Get() const {
         return ptr_;
     }
-    T& operator*() const {
+    template <typename U = T, typename = std::enable_if_t<!std::is_array_v<U>>>
+    U& operator*() const {
         return *ptr_;
     }
-    T* operator->() const {
+    template <typename U = T, typename = std::enable_if_t<!std::is_array_v<U>>>
+    U* operator->() const {
         return ptr_;
     }
+    template <typename U = T, typename = std::enable_if_t<std::is_array_v<U>>>
+    ElementType& operator[](size_t index) const {
+        return ptr_[index];
+    }
     size_t UseCount() const {
-        return block_ ? block_->Get1() : 0;
+        if constexpr (kRefCounted<ElementType>) {
+            return ptr_ ? ptr_->RefCount() : 0;
+        } else {
+            return block_ ? block_->Get1() : 0;
+        }
     }
     explicit operator bool() const {
         return ptr_ != nullptr;
     }
 
 private:
-    T* ptr_;
-    ControlBlockBase* block_;
+    template <typename U>
+    static constexpr bool kSameCounter =
+        kRefCounted<std::remove_extent_t<U>> == kRefCounted<ElementType>;
+
+    // Gives `ptr` a block. If that fails, `deleter` disposes of `ptr` at once.
+    template <typename U, typename Deleter>
+    void Adopt(U* ptr, Deleter& deleter) {
+        try {
+            block_ = new PointingConterBlock<U, Policy, Deleter>(ptr, std::move(deleter));
+        } catch (...) {
+            deleter(ptr);
+            throw;
+        }
+        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
+            if (ptr) {
+                ptr->SetSelf(ptr, block_);
+            }
+        }
+    }
+
+    // The counter of a `RefCounted` object changes even when the object is const.
+    static std::remove_cv_t<ElementType>* Counted(ElementType* ptr) {
+        return const_cast<std::remove_cv_t<ElementType>*>(ptr);
+    }
+
+    // Takes one more reference to the object.
+    void AddRef() const {
+        if constexpr (kRefCounted<ElementType>) {
+            static_assert(kAtomicRefCount<ElementType> || !kThreadSafePolicy<Policy>,
+                          "objects shared between threads need AtomicCounter");
+            if (ptr_) {
+                Counted(ptr_)->IncRef();
+            }
+        } else if (block_) {
+            block_->Increment();
+        }
+    }
+
+    using DefaultDeleter = std::conditional_t<std::is_array_v<T>, DefaultSharedArrayDelete,
+                                              DefaultSharedDelete>;
+
+    ElementType* ptr_;
+    ControlBlockBase<Policy>* block_;
 };
 
-template <typename T, typename U>
-inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right) {
+template <typename T, typename U, typename Policy>
+inline bool operator==(const SharedPtr<T, Policy>& left, const SharedPtr<U, Policy>& right) {
     return left.Get() == right.Get();
 }
 
@@ -270,14 +384,151 @@ template <typename T, typename... Ts>
 T&& GetFirst(T&& first, Ts&&...) {
     return std::forward<T>(first);
 }
-template <typename T, typename... Args>
-SharedPtr<T> MakeShared(Args&&... args) {
-
-    EmplaceConterBlock<T>* block = new EmplaceConterBlock<T>(std::forward<Args>(args)...);
-    block->Increment();
-    T* ptr = block->Get();
-    SharedPtr<T> sp(ptr, block);
-    return sp;
+template <typename T, typename Policy = SingleThreadedPolicy, typename... Args>
+std::enable_if_t<!std::is_array_v<T>, SharedPtr<T, Policy>> MakeShared(Args&&... args) {
+    if constexpr (kRefCounted<T>) {
+        // The object counts its references itself.
+        return SharedPtr<T, Policy>(new T(std::forward<Args>(args)...));
+    } else {
+        auto* block = EmplaceConterBlock<T, Policy>::Create(std::forward<Args>(args)...);
+        T* ptr = block->Get();
+        SharedPtr<T, Policy> sp(ptr, block);
+        return sp;
+    }
+}
+
+// `size` value-initialized elements, allocated together with the block.
+template <typename T, typename Policy = SingleThreadedPolicy>
+std::enable_if_t<std::is_array_v<T> && std::extent_v<T> == 0, SharedPtr<T, Policy>> MakeShared(
+    size_t size) {
+    auto* block = ArrayConterBlock<std::remove_extent_t<T>, Policy>::Create(size);
+    return SharedPtr<T, Policy>(block->Get(), block);
+}
+
+// Like `MakeShared`, but the object starts on a new cache line, so that
+// reference counting from other threads does not slow down access to it.
+template <typename T, typename Policy = SingleThreadedPolicy, typename... Args>
+SharedPtr<T, Policy> MakeSharedPadded(Args&&... args) {
+    static_assert(!kRefCounted<T>, "RefCounted objects have no control block");
+    auto* block = EmplaceConterBlock<T, Policy, kCacheLineSize>::Create(std::forward<Args>(args)...);
+    return SharedPtr<T, Policy>(block->Get(), block);
+}
+
+template <typename Policy, typename... Ts, size_t... Is>
+std::tuple<SharedPtr<Ts, Policy>...> ShareGroup(GroupConterBlock<Policy, Ts...>* block,
+                                                std::index_sequence<Is...>) {
+    return std::tuple<SharedPtr<Ts, Policy>...>(
+        SharedPtr<Ts, Policy>(block->template Get<Is>(), block)...);
+}
+
+// `MakeSharedGroup` with a counter policy.
+template <typename Policy, typename... Ts, typename... Tuples>
+std::tuple<SharedPtr<Ts, Policy>...> MakeSharedGroupWith(Tuples&&... args) {
+    static_assert(sizeof...(Ts) > 0);
+    static_assert((!kRefCounted<Ts> && ...), "RefCounted objects have no control block");
+    auto* block = new GroupConterBlock<Policy, Ts...>(std::forward<Tuples>(args)...);
+    // One reference per returned pointer, the first one is held from the start.
+    for (size_t i = 1; i < sizeof...(Ts); ++i) {
+        block->Increment();
+    }
+    return ShareGroup(block, std::index_sequence_for<Ts...>());
+}
+
+// Objects with one lifetime in a single allocation under one counter. Each of
+// `args` is a tuple of constructor arguments, e.g. from `std::forward_as_tuple`.
+template <typename... Ts, typename... Tuples>
+std::tuple<SharedPtr<Ts>...> MakeSharedGroup(Tuples&&... args) {
+    return MakeSharedGroupWith<SingleThreadedPolicy, Ts...>(std::forward<Tuples>(args)...);
+}
+
+// `MakeShared` for high-churn types: freed blocks of `T` stay in thread-local
+// free lists, spilling to a global depot, and are reused by the next calls.
+template <typename T, typename Policy = SingleThreadedPolicy, typename... Args>
+SharedPtr<T, Policy> RecyclingMakeShared(Args&&... args) {
+    static_assert(!kRefCounted<T>, "RefCounted objects have no control block");
+    auto* block = RecyclingConterBlock<T, Policy>::Create(std::forward<Args>(args)...);
+    return SharedPtr<T, Policy>(block->Get(), block);
+}
+
+// Reuse stats of `RecyclingMakeShared<T, Policy>` on the calling thread.
+template <typename T, typename Policy = SingleThreadedPolicy>
+PoolStats RecyclingStats() {
+    return RecyclingPool<RecyclingConterBlock<T, Policy>>::Stats();
+}
+
+// `count` objects `init(0)`, ..., `init(count - 1)`, each owned separately but
+// placed side by side in one allocation, which is freed when all of them die.
+template <typename T, typename Policy = SingleThreadedPolicy, typename Init>
+std::vector<SharedPtr<T, Policy>> MakeSharedBatch(size_t count, Init init) {
+    static_assert(!kRefCounted<T>, "RefCounted objects have no control block");
+    std::vector<SharedPtr<T, Policy>> result;
+    if (count == 0) {
+        return result;
+    }
+    result.reserve(count);
+    auto* first = SlabConterBlock<T, Policy>::CreateSlab(count, init);
+    for (size_t i = 0; i < count; ++i) {
+        result.emplace_back(first[i].Get(), first + i);
+    }
+    return result;
+}
+
+// Objects larger than this are allocated apart from their block by `MakeSharedSplit`.
+constexpr size_t kSplitThreshold = 4096;
+
+// Like `MakeShared`, but a large object gets its own allocation, which is freed
+// as soon as the last `SharedPtr` goes instead of when the last `WeakPtr` does.
+template <typename T, typename Policy = SingleThreadedPolicy, size_t kThreshold = kSplitThreshold,
+          typename... Args>
+SharedPtr<T, Policy> MakeSharedSplit(Args&&... args) {
+    if constexpr (sizeof(T) <= kThreshold || kRefCounted<T>) {
+        return MakeShared<T, Policy>(std::forward<Args>(args)...);
+    } else {
+        T* ptr = new T(std::forward<Args>(args)...);
+        ControlBlockBase<Policy>* block;
+        try {
+            block = new PointingConterBlock<T, Policy>(ptr);
+        } catch (...) {
+            delete ptr;
+            throw;
+        }
+        return SharedPtr<T, Policy>(ptr, block);
+    }
+}
+
+// Like `MakeShared`, but default-initializes the object (or the `size`
+// elements), so a buffer that is about to be overwritten is not zeroed first.
+template <typename T, typename Policy = SingleThreadedPolicy>
+std::enable_if_t<!std::is_array_v<T>, SharedPtr<T, Policy>> MakeSharedForOverwrite() {
+    auto* block = EmplaceConterBlock<T, Policy>::Create(ForOverwriteTag());
+    return SharedPtr<T, Policy>(block->Get(), block);
+}
+template <typename T, typename Policy = SingleThreadedPolicy>
+std::enable_if_t<std::is_array_v<T> && std::extent_v<T> == 0, SharedPtr<T, Policy>>
+MakeSharedForOverwrite(size_t size) {
+    auto* block = ArrayConterBlock<std::remove_extent_t<T>, Policy>::template Create<true>(size);
+    return SharedPtr<T, Policy>(block->Get(), block);
+}
+
+// `MakeShared` that takes the single allocation from `alloc`.
+template <typename T, typename Policy = SingleThreadedPolicy, typename Alloc, typename... Args>
+SharedPtr<T, Policy> AllocateShared(const Alloc& alloc, Args&&... args) {
+    auto* block = AllocatedConterBlock<T, Alloc, Policy>::Create(alloc, std::forward<Args>(args)...);
+    return SharedPtr<T, Policy>(block->Get(), block);
+}
+
+// Makes the object of `ptr` live until the end of the program: copies and
+// releases of pointers to it no longer write to its counter. Meant for shared
+// objects set up at startup and read from many threads afterwards.
+template <typename T, typename Policy>
+void MakeImmortal(const SharedPtr<T, Policy>& ptr) {
+    if constexpr (kRefCounted<std::remove_extent_t<T>>) {
+        if (ptr) {
+            const_cast<std::remove_cv_t<std::remove_extent_t<T>>*>(ptr.Get())->MakeImmortal();
+        }
+    } else if (ptr.GetBlock()) {
+        ptr.GetBlock()->MakeImmortal();
+    }
 }
 
 // Look for usage examples in tests
@@ -1,6 +1,20 @@
 #pragma once
 
+#include "block_pool.h"
+
+#include <unique/compressed_pair.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 class BadWeakPtr : public std::exception {
 public:
@@ -9,69 +23,1037 @@ namespace std {
 enum class byte : unsigned char;
 }
 
-template <typename T>
-class SharedPtr;
+// Threading policies for the reference counters of a control block.
+//
+// The weak counter holds one extra reference on behalf of all strong owners,
+// so the block is freed exactly once: by whoever drops the weak counter to zero.
 
-template <typename T>
-class WeakPtr;
+// What dropping a strong reference left behind.
+enum class DecrementResult {
+    kAlive,    // Other strong references remain.
+    kExpired,  // The object must be destroyed; weak references remain.
+    kLast,     // The object must be destroyed and the block freed.
+};
+
+// Strong counts from this value on are immortal: reference counting stops
+// writing them and the object is never destroyed. Reached by `MakeImmortal()`
+// or by saturation.
+constexpr uint64_t kImmortalCount = uint64_t(1) << 30;
 
-class ControlBlockBase {
+// Both counters share one 64-bit word: the strong count in the upper half and
+// the weak count in the lower one. A single read-modify-write on release tells
+// whether anything else still refers to the block.
+class PackedCounters {
+protected:
+    static constexpr uint64_t kWeakOne = 1;
+    static constexpr uint64_t kStrongOne = uint64_t(1) << 32;
+    static constexpr uint64_t kInitial = kStrongOne + kWeakOne;
+    static constexpr uint64_t kImmortal = kImmortalCount * kStrongOne;
+
+    static DecrementResult Decremented(uint64_t old) {
+        if (old == kInitial) {
+            return DecrementResult::kLast;
+        }
+        return (old >> 32) == 1 ? DecrementResult::kExpired : DecrementResult::kAlive;
+    }
+    static int Strong(uint64_t word) {
+        return static_cast<int>(word >> 32);
+    }
+    static int Weak(uint64_t word) {
+        return static_cast<int>(word & (kStrongOne - 1));
+    }
+    static bool Immortal(uint64_t word) {
+        return word >= kImmortal;
+    }
+};
+
+// Plain integers, the default. `SharedPtr`/`WeakPtr` must not cross threads.
+class SingleThreadedPolicy : private PackedCounters {
 public:
-    virtual ~ControlBlockBase() = default;
+    void Increment() {
+        if (!Immortal(counters_)) {
+            counters_ += kStrongOne;
+        }
+    }
+    void IncrementWeak() {
+        counters_ += kWeakOne;
+    }
+    // Takes a strong reference unless the object has already expired.
+    bool IncrementIfNotZero() {
+        if (Strong(counters_) == 0) {
+            return false;
+        }
+        Increment();
+        return true;
+    }
+    DecrementResult Decrement() {
+        uint64_t old = counters_;
+        if (Immortal(old)) {
+            return DecrementResult::kAlive;
+        }
+        counters_ -= kStrongOne;
+        return Decremented(old);
+    }
+    // Returns true if the block can be deallocated.
+    bool DecrementWeak() {
+        return (counters_ -= kWeakOne) == 0;
+    }
+    int Get1() const {
+        return Strong(counters_);
+    }
+    int Get2() const {
+        return Weak(counters_);
+    }
+    void MakeImmortal() {
+        counters_ |= kImmortal;
+    }
+
+private:
+    uint64_t counters_ = kInitial;
+};
 
+// Atomic counters: pointers to the same block may be copied and released
+// concurrently from different threads.
+class AtomicPolicy : private PackedCounters {
+public:
+    // Immortal counters are only read, so their cache line stays shared.
     void Increment() {
-        ++count_;
+        if (!Immortal(counters_.load(std::memory_order_relaxed))) {
+            counters_.fetch_add(kStrongOne, std::memory_order_relaxed);
+        }
+    }
+    void Increment(int count) {
+        if (!Immortal(counters_.load(std::memory_order_relaxed))) {
+            counters_.fetch_add(count * kStrongOne, std::memory_order_relaxed);
+        }
     }
     void IncrementWeak() {
-        ++weak_count_;
+        counters_.fetch_add(kWeakOne, std::memory_order_relaxed);
+    }
+    bool IncrementIfNotZero() {
+        uint64_t counters = counters_.load(std::memory_order_relaxed);
+        while (Strong(counters) != 0) {
+            if (Immortal(counters)) {
+                return true;
+            }
+            if (counters_.compare_exchange_weak(counters, counters + kStrongOne,
+                                                std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
     }
-    void Decrement() {
-        --count_;
+    DecrementResult Decrement() {
+        if (Immortal(counters_.load(std::memory_order_relaxed))) {
+            return DecrementResult::kAlive;
+        }
+        return Decremented(counters_.fetch_sub(kStrongOne, std::memory_order_acq_rel));
     }
-    void DecrementWeak() {
-        --weak_count_;
+    bool DecrementWeak() {
+        return counters_.fetch_sub(kWeakOne, std::memory_order_acq_rel) == kWeakOne;
     }
     int Get1() const {
-        return count_;
+        return Strong(counters_.load(std::memory_order_relaxed));
     }
     int Get2() const {
-        return weak_count_;
+        return Weak(counters_.load(std::memory_order_relaxed));
+    }
+    void MakeImmortal() {
+        counters_.fetch_or(kImmortal, std::memory_order_relaxed);
     }
-    virtual void Destroy() = 0;
 
 private:
-    int count_ = 0;
-    int weak_count_ = 0;
+    std::atomic<uint64_t> counters_ = kInitial;
 };
 
-template <typename T>
-class PointingConterBlock : public ControlBlockBase {
+// A single strong counter for objects never observed through `WeakPtr`:
+// releasing the last reference destroys the object and frees the block at once.
+class StrongOnlyPolicy {
+public:
+    void Increment() {
+        if (count_ < kImmortalCount) {
+            ++count_;
+        }
+    }
+    DecrementResult Decrement() {
+        if (count_ >= kImmortalCount) {
+            return DecrementResult::kAlive;
+        }
+        return --count_ == 0 ? DecrementResult::kLast : DecrementResult::kAlive;
+    }
+    int Get1() const {
+        return static_cast<int>(count_);
+    }
+    void MakeImmortal() {
+        count_ |= kImmortalCount;
+    }
+
+private:
+    uint64_t count_ = 1;
+};
+
+// `StrongOnlyPolicy` that may cross threads.
+class AtomicStrongOnlyPolicy {
 public:
-    explicit PointingConterBlock(T* ptr) : ptr_(ptr) {
+    void Increment() {
+        if (count_.load(std::memory_order_relaxed) < kImmortalCount) {
+            count_.fetch_add(1, std::memory_order_relaxed);
+        }
     }
-    void Destroy() override {
-        delete ptr_;
-        ptr_ = nullptr;
+    DecrementResult Decrement() {
+        if (count_.load(std::memory_order_relaxed) >= kImmortalCount) {
+            return DecrementResult::kAlive;
+        }
+        return count_.fetch_sub(1, std::memory_order_acq_rel) == 1 ? DecrementResult::kLast
+                                                                   : DecrementResult::kAlive;
+    }
+    int Get1() const {
+        return static_cast<int>(count_.load(std::memory_order_relaxed));
+    }
+    void MakeImmortal() {
+        count_.fetch_or(kImmortalCount, std::memory_order_relaxed);
     }
 
 private:
-    T* ptr_;
+    std::atomic<uint64_t> count_ = 1;
 };
 
+// Whether a policy counts weak references, i.e. supports `WeakPtr`.
+template <typename Policy, typename = void>
+constexpr bool kCountsWeak = false;
+template <typename Policy>
+constexpr bool kCountsWeak<Policy, std::void_t<decltype(&Policy::DecrementWeak)>> = true;
+
+template <typename Policy>
+class ControlBlockBase;
+
+class BiasedOwner;
+
+// Biased counters: the thread that created the block updates its own counter
+// with plain loads and stores, other threads go through the atomic shared one.
+// When the owner's counter drops to zero it merges into the shared counter,
+// after which every thread uses the shared counter only.
+//
+// A reference counted by the owner may be released by another thread, driving
+// the shared counter below zero. Such a block is queued to the owner, which
+// merges it on its next release, on `MergeQueued()` or when it exits.
+class BiasedPolicy {
+public:
+    BiasedPolicy();
+    BiasedPolicy(const BiasedPolicy&) = delete;
+    BiasedPolicy& operator=(const BiasedPolicy&) = delete;
+    ~BiasedPolicy();
+
+    void Increment() {
+        if (IsBiased()) {
+            biased_.store(biased_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        } else {
+            shared_.fetch_add(kOne, std::memory_order_relaxed);
+        }
+    }
+    void IncrementWeak() {
+        weak_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    bool IncrementIfNotZero();
+    DecrementResult Decrement();
+    bool DecrementWeak() {
+        return weak_count_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+    int Get1() const {
+        int shared = static_cast<int>(shared_.load(std::memory_order_relaxed) >> 2);
+        return shared + biased_.load(std::memory_order_relaxed);
+    }
+    int Get2() const {
+        return weak_count_.load(std::memory_order_relaxed);
+    }
+
+    // Merges the blocks queued to the calling thread.
+    static void MergeQueued();
+
+private:
+    friend class BiasedOwner;
+
+    // `shared_` keeps the count of the other threads shifted by two bits.
+    static constexpr long long kMerged = 1;
+    static constexpr long long kQueued = 2;
+    static constexpr long long kOne = 4;
+
+    bool IsBiased() const;
+    // Moves the owner's counter into the shared one.
+    // Returns true if no references are left.
+    bool Merge() {
+        int biased = biased_.load(std::memory_order_relaxed);
+        biased_.store(0, std::memory_order_relaxed);
+        merged_ = true;
+        long long old = shared_.fetch_add(biased * kOne + kMerged, std::memory_order_acq_rel);
+        return (old >> 2) + biased == 0;
+    }
+    void Queue();
+
+    BiasedOwner* owner_;
+    bool merged_ = false;  // Touched by the owner only while it is alive.
+    std::atomic<int> biased_ = 1;
+    std::atomic<long long> shared_ = 0;
+    std::atomic<int> weak_count_ = 1;
+};
+
+template <typename Derived, typename Counter, typename Deleter>
+class RefCounted;
+
 template <typename T>
-class EmplaceConterBlock : public ControlBlockBase {
+class IntrusivePtr;
+
+template <typename Derived, typename Counter, typename Deleter>
+std::true_type DetectRefCounted(const RefCounted<Derived, Counter, Deleter>*);
+std::false_type DetectRefCounted(...);
+
+// Objects of `RefCounted` types (intrusive/intrusive.h) carry their own counter,
+// which `SharedPtr` uses instead of a control block. Check complete types only.
+template <typename T>
+constexpr bool kRefCounted = decltype(DetectRefCounted(std::declval<T*>()))::value;
+
+class AtomicCounter;
+
+template <typename Counter>
+struct EmbeddedCounter;
+
+template <typename Derived, typename Counter, typename Deleter>
+Counter DetectRefCounter(const RefCounted<Derived, Counter, Deleter>*);
+
+// Whether the counter of a `RefCounted` type may be shared between threads.
+template <typename T>
+constexpr bool kAtomicRefCount =
+    std::is_same_v<decltype(DetectRefCounter(std::declval<T*>())), AtomicCounter> ||
+    std::is_same_v<decltype(DetectRefCounter(std::declval<T*>())), EmbeddedCounter<AtomicCounter>>;
+
+// Whether pointers with a policy may be copied and released from several threads.
+template <typename Policy>
+constexpr bool kThreadSafePolicy = false;
+template <>
+constexpr bool kThreadSafePolicy<AtomicPolicy> = true;
+template <>
+constexpr bool kThreadSafePolicy<AtomicStrongOnlyPolicy> = true;
+template <>
+constexpr bool kThreadSafePolicy<BiasedPolicy> = true;
+
+template <typename T, typename Policy = SingleThreadedPolicy>
+class SharedPtr;
+
+// Whether `SharedPtr<T>` may adopt a `U*`. As with `std::shared_ptr`, `T[]`
+// only takes elements of the same type: `Base[]` indexes `new Derived[n]` with
+// the wrong stride.
+template <typename U, typename T>
+struct IsAdoptable : std::is_convertible<U*, T*> {};
+template <typename U, typename T>
+struct IsAdoptable<U, T[]> : std::is_convertible<U (*)[], T (*)[]> {};
+
+// Whether `SharedPtr<U>` converts to `SharedPtr<T>`: never between arrays and
+// single objects, nor between arrays of different element types.
+template <typename U, typename T>
+constexpr bool kCompatiblePtr = std::is_convertible_v<U*, T*>;
+
+template <typename T, typename Policy = SingleThreadedPolicy>
+class WeakPtr;
+
+enum class BlockOp { kDestroy, kDeallocate, kDestroyAndDeallocate, kObject };
+
+// Control blocks carry no vtable: the concrete block type is reached through a
+// single manager function stored next to the counters. The header is thus no
+// smaller than with a vptr, but the last release makes one indirect call.
+template <typename Policy>
+class ControlBlockBase : public Policy {
 public:
+    using Manager = void* (*)(ControlBlockBase*, BlockOp);
+
+    explicit ControlBlockBase(Manager manager) : manager_(manager) {
+    }
+
+    // Destroys the owned object.
+    void Destroy() {
+        manager_(this, BlockOp::kDestroy);
+    }
+    // Frees the block itself.
+    void Deallocate() {
+        manager_(this, BlockOp::kDeallocate);
+    }
+    // `Destroy()` and `Deallocate()` at once, for the last reference.
+    void DestroyAndDeallocate() {
+        manager_(this, BlockOp::kDestroyAndDeallocate);
+    }
+    // The object owned by the block.
+    void* Object() {
+        return manager_(this, BlockOp::kObject);
+    }
+
+private:
+    Manager manager_;
+};
+
+// Base of the concrete blocks, holding their manager function: `Block` only
+// supplies `DestroyObject()`, `FreeBlock()` and `OwnedObject()`.
+template <typename Block, typename Policy>
+class ManagedBlock : public ControlBlockBase<Policy> {
+protected:
+    ManagedBlock() : ControlBlockBase<Policy>(&Manage) {
+    }
+
+private:
+    static void* Manage(ControlBlockBase<Policy>* base, BlockOp op) {
+        auto* self = static_cast<Block*>(base);
+        switch (op) {
+            case BlockOp::kDestroy:
+                self->DestroyObject();
+                break;
+            case BlockOp::kDeallocate:
+                self->FreeBlock();
+                break;
+            case BlockOp::kDestroyAndDeallocate:
+                self->DestroyObject();
+                self->FreeBlock();
+                break;
+            case BlockOp::kObject:
+                return self->OwnedObject();
+        }
+        return nullptr;
+    }
+};
+
+struct DefaultSharedDelete {
+    template <typename T>
+    void operator()(T* ptr) const {
+        delete ptr;
+    }
+};
+
+// Deleter of raw arrays adopted by `SharedPtr<T[]>`.
+struct DefaultSharedArrayDelete {
+    template <typename T>
+    void operator()(T* ptr) const {
+        delete[] ptr;
+    }
+};
+
+template <typename T, typename Policy, typename Deleter = DefaultSharedDelete>
+class PointingConterBlock;
+
+// Base of `EnableSharedFromThis`: the control block of the owners, or zero.
+class ESFTBase {
+protected:
+    ESFTBase() noexcept = default;
+    // A copy is a different object, not owned by the owners of the original.
+    ESFTBase(const ESFTBase&) noexcept {
+    }
+    ESFTBase& operator=(const ESFTBase&) noexcept {
+        return *this;
+    }
+
+    uint64_t self_ = 0;
+
+private:
+    template <typename T, typename Policy, typename Deleter>
+    friend class PointingConterBlock;
+
+    // A custom deleter may leave the object alive after its block is gone.
+    void ForgetOwners() {
+        self_ = 0;
+    }
+};
+
+template <typename T, typename Policy, typename Deleter>
+class PointingConterBlock : public ManagedBlock<PointingConterBlock<T, Policy, Deleter>, Policy> {
+public:
+    explicit PointingConterBlock(T* ptr, Deleter deleter = Deleter())
+        : pair_(ptr, std::move(deleter)) {
+    }
+
+    // Adopting a raw pointer allocates the block separately, so take it from a pool.
+    static void* operator new(std::size_t size) {
+        if constexpr (kPoolable<PointingConterBlock>) {
+            return ControlBlockPool<PointingConterBlock>::Allocate();
+        } else {
+            return ::operator new(size);
+        }
+    }
+    static void operator delete(void* ptr) {
+        if constexpr (kPoolable<PointingConterBlock>) {
+            ControlBlockPool<PointingConterBlock>::Deallocate(ptr);
+        } else {
+            ::operator delete(ptr);
+        }
+    }
+
+private:
+    friend class ManagedBlock<PointingConterBlock, Policy>;
+
+    void DestroyObject() {
+        // Only mutable objects get their owners set, const ones may live in
+        // read-only memory.
+        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
+            if (pair_.GetFirst()) {
+                static_cast<ESFTBase*>(pair_.GetFirst())->ForgetOwners();
+            }
+        }
+        pair_.GetSecond()(pair_.GetFirst());
+        pair_.GetFirst() = nullptr;
+    }
+    void FreeBlock() {
+        delete this;
+    }
+    void* OwnedObject() {
+        return const_cast<std::remove_cv_t<T>*>(pair_.GetFirst());
+    }
+
+    // An empty deleter takes no space.
+    CompressedPair<T*, Deleter> pair_;
+};
+
+// Asks a block to default-initialize its object: trivial types are left
+// uninitialized instead of being zeroed.
+struct ForOverwriteTag {};
+
+// Size of a cache line on the targets we care about.
+constexpr size_t kCacheLineSize = 64;
+
+// The global `operator new` for memory aligned to `kAlignment`.
+template <size_t kAlignment>
+struct BlockMemory {
+    static void* Allocate(size_t bytes) {
+        if constexpr (kAlignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            return ::operator new(bytes, std::align_val_t(kAlignment));
+        } else {
+            return ::operator new(bytes);
+        }
+    }
+    static void Free(void* ptr, size_t bytes) {
+        if constexpr (kAlignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            ::operator delete(ptr, bytes, std::align_val_t(kAlignment));
+        } else {
+            ::operator delete(ptr, bytes);
+        }
+    }
+};
+
+// Memory of a `Header` followed by `count` objects of type `T`.
+template <typename Header, typename T>
+struct TrailingArray {
+    static constexpr size_t kOffset = (sizeof(Header) + alignof(T) - 1) / alignof(T) * alignof(T);
+    using Memory = BlockMemory<std::max(alignof(Header), alignof(T))>;
+
+    // Throws `std::bad_array_new_length` if the size does not fit in `size_t`.
+    static void* Allocate(size_t count) {
+        if (count > (SIZE_MAX - kOffset) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return Memory::Allocate(Bytes(count));
+    }
+    static void Free(void* ptr, size_t count) {
+        Memory::Free(ptr, Bytes(count));
+    }
+    static T* Elements(void* header) {
+        return reinterpret_cast<T*>(static_cast<std::byte*>(header) + kOffset);
+    }
+
+private:
+    static constexpr size_t Bytes(size_t count) {
+        return kOffset + count * sizeof(T);
+    }
+};
+
+// Where `EmplaceConterBlock` takes its memory from: the global `operator new`...
+struct HeapAllocation {
+    template <typename Block>
+    static void* Allocate() {
+        return BlockMemory<alignof(Block)>::Allocate(sizeof(Block));
+    }
+    template <typename Block>
+    static void Deallocate(void* ptr) {
+        BlockMemory<alignof(Block)>::Free(ptr, sizeof(Block));
+    }
+};
+
+// ...or a pool of the block type, so that freed blocks are reused.
+struct RecyclingAllocation {
+    template <typename Block>
+    static void* Allocate() {
+        static_assert(alignof(Block) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                      "over-aligned types can't be recycled");
+        return RecyclingPool<Block>::Allocate();
+    }
+    template <typename Block>
+    static void Deallocate(void* ptr) {
+        RecyclingPool<Block>::Deallocate(ptr);
+    }
+};
+
+// `kAlign` above `alignof(T)` moves the object away from the counters: with
+// `kCacheLineSize` they never share a cache line.
+template <typename T, typename Policy, size_t kAlign = alignof(T),
+          typename Allocation = HeapAllocation>
+class EmplaceConterBlock
+    : public ManagedBlock<EmplaceConterBlock<T, Policy, kAlign, Allocation>, Policy> {
+public:
+    // Builds the object from `args`, or default-initializes it for `ForOverwriteTag`.
+    template <typename... Args>
+    static EmplaceConterBlock* Create(Args&&... args) {
+        void* memory = Allocation::template Allocate<EmplaceConterBlock>();
+        try {
+            return ::new (memory) EmplaceConterBlock(std::forward<Args>(args)...);
+        } catch (...) {
+            Allocation::template Deallocate<EmplaceConterBlock>(memory);
+            throw;
+        }
+    }
+
+    T* Get() {
+        return reinterpret_cast<T*>(&buffer_);
+    }
+
+private:
     template <typename... Args>
     explicit EmplaceConterBlock(Args&&... args) {
-        new (&buffer_) T(std::forward<Args>(args)...);
+        ::new (static_cast<void*>(&buffer_)) T(std::forward<Args>(args)...);
+    }
+    explicit EmplaceConterBlock(ForOverwriteTag) {
+        ::new (static_cast<void*>(&buffer_)) T;
     }
-    void Destroy() override {
+
+    friend class ManagedBlock<EmplaceConterBlock, Policy>;
+
+    void DestroyObject() {
         Get()->~T();
     }
+    void FreeBlock() {
+        this->~EmplaceConterBlock();
+        Allocation::template Deallocate<EmplaceConterBlock>(this);
+    }
+    void* OwnedObject() {
+        return const_cast<std::remove_cv_t<T>*>(Get());
+    }
+
+    alignas(T) alignas(kAlign) std::byte buffer_[sizeof(T)];
+};
+
+// `EmplaceConterBlock` whose memory is recycled through a pool of its own type
+// instead of going back to `operator delete`.
+template <typename T, typename Policy>
+using RecyclingConterBlock = EmplaceConterBlock<T, Policy, alignof(T), RecyclingAllocation>;
+
+// Control block of `MakeShared<T[]>`: the length and the elements follow the
+// block in the same allocation.
+template <typename T, typename Policy>
+class ArrayConterBlock : public ManagedBlock<ArrayConterBlock<T, Policy>, Policy> {
+public:
+    template <bool kForOverwrite = false>
+    static ArrayConterBlock* Create(size_t size) {
+        auto* block = new (Layout::Allocate(size)) ArrayConterBlock(size);
+        size_t constructed = 0;
+        try {
+            for (; constructed < size; ++constructed) {
+                if constexpr (kForOverwrite) {
+                    ::new (static_cast<void*>(block->Get() + constructed)) T;
+                } else {
+                    ::new (static_cast<void*>(block->Get() + constructed)) T();
+                }
+            }
+        } catch (...) {
+            block->DestroyElements(constructed);
+            block->~ArrayConterBlock();
+            Layout::Free(block, size);
+            throw;
+        }
+        return block;
+    }
+
+    T* Get() {
+        return Layout::Elements(this);
+    }
+    size_t Size() const {
+        return size_;
+    }
+
+private:
+    using Layout = TrailingArray<ArrayConterBlock, T>;
+
+    explicit ArrayConterBlock(size_t size) : size_(size) {
+    }
+
+    // Destroys the first `count` elements in reverse order.
+    void DestroyElements(size_t count) {
+        while (count > 0) {
+            Get()[--count].~T();
+        }
+    }
+
+    friend class ManagedBlock<ArrayConterBlock, Policy>;
+
+    void DestroyObject() {
+        DestroyElements(size_);
+    }
+    void FreeBlock() {
+        size_t size = size_;
+        this->~ArrayConterBlock();
+        Layout::Free(this, size);
+    }
+    void* OwnedObject() {
+        return const_cast<std::remove_cv_t<T>*>(Get());
+    }
+
+    size_t size_;
+};
+
+// Several objects with one lifetime behind a single block, destroyed in the
+// reverse order of construction.
+template <typename Policy, typename... Ts>
+class GroupConterBlock : public ManagedBlock<GroupConterBlock<Policy, Ts...>, Policy> {
+public:
+    // Each of `args` is a tuple of constructor arguments of the matching type.
+    template <typename... Tuples>
+    explicit GroupConterBlock(Tuples&&... args) {
+        static_assert(sizeof...(Tuples) == sizeof...(Ts));
+        size_t constructed = 0;
+        try {
+            ConstructAll(constructed, std::index_sequence_for<Ts...>(),
+                         std::forward<Tuples>(args)...);
+        } catch (...) {
+            DestroyFirst(constructed, std::index_sequence_for<Ts...>());
+            throw;
+        }
+    }
+
+    template <size_t kIndex>
+    auto* Get() {
+        using T = std::tuple_element_t<kIndex, std::tuple<Ts...>>;
+        return reinterpret_cast<T*>(&std::get<kIndex>(slots_).buffer);
+    }
+
+private:
+    template <typename T>
+    struct Slot {
+        alignas(T) std::byte buffer[sizeof(T)];
+    };
+
+    template <size_t... Is, typename... Tuples>
+    void ConstructAll(size_t& constructed, std::index_sequence<Is...>, Tuples&&... args) {
+        ((Construct<Is>(std::forward<Tuples>(args)), ++constructed), ...);
+    }
+    template <size_t kIndex, typename Tuple>
+    void Construct(Tuple&& args) {
+        using T = std::tuple_element_t<kIndex, std::tuple<Ts...>>;
+        ::new (static_cast<void*>(Get<kIndex>())) T(std::make_from_tuple<T>(std::forward<Tuple>(args)));
+    }
+
+    // Destroys the first `count` objects, last to first.
+    template <size_t... Is>
+    void DestroyFirst(size_t count, std::index_sequence<Is...>) {
+        constexpr size_t kSize = sizeof...(Is);
+        ((kSize - 1 - Is < count ? Destroy<kSize - 1 - Is>() : void()), ...);
+    }
+    template <size_t kIndex>
+    void Destroy() {
+        using T = std::tuple_element_t<kIndex, std::tuple<Ts...>>;
+        Get<kIndex>()->~T();
+    }
+
+    friend class ManagedBlock<GroupConterBlock, Policy>;
+
+    void DestroyObject() {
+        DestroyFirst(sizeof...(Ts), std::index_sequence_for<Ts...>());
+    }
+    void FreeBlock() {
+        delete this;
+    }
+    // The first object stands for the group.
+    void* OwnedObject() {
+        return const_cast<void*>(static_cast<const volatile void*>(Get<0>()));
+    }
+
+    std::tuple<Slot<Ts>...> slots_;
+};
+
+// Block of `MakeSharedBatch`: every object has its own block and counters, but
+// the blocks of a batch lie next to each other in one slab. The slab is freed
+// with the last of its blocks.
+template <typename T, typename Policy>
+class SlabConterBlock : public ManagedBlock<SlabConterBlock<T, Policy>, Policy> {
+public:
+    // Builds `count` blocks with objects `init(0)`, ..., `init(count - 1)` and
+    // returns the first block.
+    template <typename Init>
+    static SlabConterBlock* CreateSlab(size_t count, Init& init) {
+        void* memory = Layout::Allocate(count);
+        auto* header = new (memory) Header{count, count};
+        SlabConterBlock* first = Layout::Elements(memory);
+        size_t constructed = 0;
+        try {
+            for (; constructed < count; ++constructed) {
+                auto* block = new (first + constructed) SlabConterBlock(header);
+                try {
+                    ::new (static_cast<void*>(block->Get())) T(init(constructed));
+                } catch (...) {
+                    block->~SlabConterBlock();
+                    throw;
+                }
+            }
+        } catch (...) {
+            while (constructed > 0) {
+                SlabConterBlock* block = first + --constructed;
+                block->Get()->~T();
+                block->~SlabConterBlock();
+            }
+            Layout::Free(memory, count);
+            throw;
+        }
+        return first;
+    }
+
     T* Get() {
         return reinterpret_cast<T*>(&buffer_);
     }
 
 private:
+    struct Header {
+        std::atomic<size_t> live;
+        size_t count;
+    };
+
+    using Layout = TrailingArray<Header, SlabConterBlock>;
+
+    explicit SlabConterBlock(Header* header) : header_(header) {
+    }
+
+    friend class ManagedBlock<SlabConterBlock, Policy>;
+
+    void DestroyObject() {
+        Get()->~T();
+    }
+    void FreeBlock() {
+        Header* header = header_;
+        this->~SlabConterBlock();
+        // Blocks of one batch may die on different threads.
+        if (header->live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            size_t count = header->count;
+            header->~Header();
+            Layout::Free(header, count);
+        }
+    }
+    void* OwnedObject() {
+        return const_cast<std::remove_cv_t<T>*>(Get());
+    }
+
+    Header* header_;
     alignas(T) std::byte buffer_[sizeof(T)];
 };
+
+// Like `EmplaceConterBlock`, but the block is allocated by a user allocator
+// that is kept inside the block until it frees it.
+template <typename T, typename Alloc, typename Policy>
+class AllocatedConterBlock
+    : public ManagedBlock<AllocatedConterBlock<T, Alloc, Policy>, Policy> {
+public:
+    using BlockAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<AllocatedConterBlock>;
+    using BlockTraits = std::allocator_traits<BlockAlloc>;
+
+    template <typename... Args>
+    static AllocatedConterBlock* Create(const Alloc& alloc, Args&&... args) {
+        BlockAlloc block_alloc(alloc);
+        AllocatedConterBlock* block = BlockTraits::allocate(block_alloc, 1);
+        try {
+            return new (block) AllocatedConterBlock(block_alloc, std::forward<Args>(args)...);
+        } catch (...) {
+            BlockTraits::deallocate(block_alloc, block, 1);
+            throw;
+        }
+    }
+
+    T* Get() {
+        return reinterpret_cast<T*>(&pair_.GetSecond().buffer);
+    }
+
+private:
+    struct Storage {
+        explicit Storage(std::nullptr_t) {
+        }
+
+        alignas(T) std::byte buffer[sizeof(T)];
+    };
+
+    template <typename... Args>
+    explicit AllocatedConterBlock(const BlockAlloc& alloc, Args&&... args)
+        : pair_(alloc, nullptr) {
+        ::new (static_cast<void*>(&pair_.GetSecond().buffer)) T(std::forward<Args>(args)...);
+    }
+
+    friend class ManagedBlock<AllocatedConterBlock, Policy>;
+
+    void DestroyObject() {
+        Get()->~T();
+    }
+    void FreeBlock() {
+        BlockAlloc alloc(std::move(pair_.GetFirst()));
+        this->~AllocatedConterBlock();
+        BlockTraits::deallocate(alloc, this, 1);
+    }
+    void* OwnedObject() {
+        return const_cast<std::remove_cv_t<T>*>(Get());
+    }
+
+    // A stateless allocator takes no space.
+    CompressedPair<BlockAlloc, Storage> pair_;
+};
+
+// Per-thread state of `BiasedPolicy`, shared with the blocks owned by the thread.
+class BiasedOwner {
+public:
+    static BiasedOwner* Current() {
+        static thread_local Holder holder;
+        return holder.owner;
+    }
+
+    void Ref() {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void Unref() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    bool HasPending() const {
+        return pending_.load(std::memory_order_relaxed);
+    }
+
+    // Returns false if the owner thread has already exited.
+    bool Push(ControlBlockBase<BiasedPolicy>* block) {
+        std::lock_guard guard(mutex_);
+        if (!alive_) {
+            return false;
+        }
+        block->IncrementWeak();
+        queue_.push_back(block);
+        pending_.store(true, std::memory_order_relaxed);
+        return true;
+    }
+
+    void MergeQueued() {
+        std::vector<ControlBlockBase<BiasedPolicy>*> queue;
+        {
+            std::lock_guard guard(mutex_);
+            queue.swap(queue_);
+            pending_.store(false, std::memory_order_relaxed);
+        }
+        for (auto* block : queue) {
+            if (!block->merged_ && block->Merge()) {
+                Release(block);
+            }
+            if (block->DecrementWeak()) {
+                block->Deallocate();
+            }
+        }
+    }
+
+    static void Release(ControlBlockBase<BiasedPolicy>* block) {
+        block->Destroy();
+        if (block->DecrementWeak()) {
+            block->Deallocate();
+        }
+    }
+
+private:
+    struct Holder {
+        Holder() : owner(new BiasedOwner) {
+        }
+        ~Holder() {
+            owner->MergeQueued();
+            {
+                std::lock_guard guard(owner->mutex_);
+                owner->alive_ = false;
+            }
+            owner->MergeQueued();
+            owner->Unref();
+        }
+
+        BiasedOwner* owner;
+    };
+
+    std::mutex mutex_;
+    std::vector<ControlBlockBase<BiasedPolicy>*> queue_;
+    bool alive_ = true;
+    std::atomic<bool> pending_ = false;
+    std::atomic<int> refs_ = 1;
+};
+
+inline BiasedPolicy::BiasedPolicy() : owner_(BiasedOwner::Current()) {
+    owner_->Ref();
+}
+
+inline BiasedPolicy::~BiasedPolicy() {
+    owner_->Unref();
+}
+
+inline bool BiasedPolicy::IsBiased() const {
+    return owner_ == BiasedOwner::Current() && !merged_;
+}
+
+inline bool BiasedPolicy::IncrementIfNotZero() {
+    if (IsBiased()) {
+        // Releases by other threads may have taken the owner's references
+        // while the merge is still queued.
+        long long shared = shared_.load(std::memory_order_acquire) >> 2;
+        if (shared + biased_.load(std::memory_order_relaxed) <= 0) {
+            return false;
+        }
+        Increment();
+        return true;
+    }
+    // Acquiring `shared_` makes visible every update of `biased_` that came
+    // before a release counted in it. Any merge changes `shared_` and fails
+    // the exchange below.
+    long long shared = shared_.load(std::memory_order_acquire);
+    while (true) {
+        long long count = shared >> 2;
+        if (!(shared & kMerged)) {
+            count += biased_.load(std::memory_order_acquire);
+        }
+        if (count <= 0) {
+            return false;
+        }
+        if (shared_.compare_exchange_weak(shared, shared + kOne, std::memory_order_acquire)) {
+            return true;
+        }
+    }
+}
+
+inline DecrementResult BiasedPolicy::Decrement() {
+    if (IsBiased()) {
+        int biased = biased_.load(std::memory_order_relaxed) - 1;
+        biased_.store(biased, std::memory_order_relaxed);
+        bool last = biased == 0 && Merge();
+        if (owner_->HasPending()) {
+            owner_->MergeQueued();
+        }
+        return last ? DecrementResult::kExpired : DecrementResult::kAlive;
+    }
+    long long old = shared_.fetch_sub(kOne, std::memory_order_acq_rel);
+    if (old & kMerged) {
+        bool last = (old & ~kQueued) == (kOne | kMerged);
+        return last ? DecrementResult::kExpired : DecrementResult::kAlive;
+    }
+    if ((old >> 2) <= 0 && !(old & kQueued) &&
+        !(shared_.fetch_or(kQueued, std::memory_order_relaxed) & (kQueued | kMerged))) {
+        Queue();
+    }
+    return DecrementResult::kAlive;
+}
+
+inline void BiasedPolicy::Queue() {
+    auto* block = static_cast<ControlBlockBase<BiasedPolicy>*>(this);
+    if (!owner_->Push(block) && Merge()) {
+        // The owner has exited, so its counter can no longer change.
+        BiasedOwner::Release(block);
+    }
+}
+
+inline void BiasedPolicy::MergeQueued() {
+    BiasedOwner::Current()->MergeQueued();
+}
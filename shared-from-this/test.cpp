@@ -89,3 +89,59 @@ TEST_CASE("WeakFromThis") {
     REQUIRE(!weak.Expired());
     REQUIRE(weak.Lock().Get() == ptr);
 }
+
+struct Big : virtual public EnableSharedFromThis<Big> {
+    char data[4096];
+};
+
+TEST_CASE("SharedFromThis without WeakPtr") {
+    static_assert(sizeof(EnableSharedFromThis<T>) == sizeof(void*));
+
+    SECTION("Weak count is untouched") {
+        auto sp = MakeShared<T>();
+        REQUIRE(sp.GetBlock()->Get2() == 1);
+        auto self = sp->SharedFromThis();
+        REQUIRE(sp.UseCount() == 2);
+        REQUIRE(sp.GetBlock()->Get2() == 1);
+        WeakPtr<T> weak = sp->WeakFromThis();
+        REQUIRE(sp.GetBlock()->Get2() == 2);
+    }
+
+    SECTION("Virtual base") {
+        auto big = MakeShared<Big>();
+        REQUIRE(big->SharedFromThis() == big);
+        REQUIRE(big->WeakFromThis().Lock() == big);
+        SharedPtr<Big> adopted(new Big);
+        REQUIRE(adopted->SharedFromThis() == adopted);
+    }
+
+    SECTION("Copies are not owned") {
+        auto sp = MakeShared<T>();
+        T copy = *sp;
+        REQUIRE(!copy.SharedFromThis());
+        REQUIRE(copy.WeakFromThis().Expired());
+        copy = *sp;
+        REQUIRE(!copy.SharedFromThis());
+    }
+
+    SECTION("Object outlives its owners") {
+        static T object;
+        {
+            SharedPtr<T> sp(&object, NullDeleter);
+            REQUIRE(object.SharedFromThis() == sp);
+        }
+        // The next adopted pointer may get the freed block.
+        SharedPtr<T> other(new T);
+        REQUIRE(!object.SharedFromThis());
+        REQUIRE(object.WeakFromThis().Expired());
+    }
+
+    SECTION("Const object outlives its owners") {
+        static const T kObject;
+        {
+            SharedPtr<const T> sp(&kObject, [](const T*) {});
+            REQUIRE(sp.Get() == &kObject);
+        }
+        REQUIRE(!kObject.SharedFromThis());
+    }
+}
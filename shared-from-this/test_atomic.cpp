@@ -0,0 +1,330 @@
+#include "atomic_shared.h"
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Counted {
+    static inline std::atomic<int> alive = 0;
+
+    Counted() {
+        ++alive;
+    }
+    ~Counted() {
+        --alive;
+    }
+};
+
+constexpr int kNumThreads = 4;
+constexpr int kNumIters = 100'000;
+
+template <typename F>
+void RunInThreads(F f) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back(f);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+}  // namespace
+
+TEST_CASE("Atomic policy copies") {
+    {
+        SharedPtr<Counted, AtomicPolicy> sp(new Counted);
+        std::atomic<bool> same = true;
+        RunInThreads([sp, &same] {
+            for (int i = 0; i < kNumIters; ++i) {
+                SharedPtr<Counted, AtomicPolicy> copy = sp;
+                if (copy.Get() != sp.Get()) {
+                    same = false;
+                }
+            }
+        });
+        REQUIRE(same);
+        REQUIRE(sp.UseCount() == 1);
+        REQUIRE(Counted::alive == 1);
+    }
+    REQUIRE(Counted::alive == 0);
+}
+
+TEST_CASE("Atomic policy last owner") {
+    for (int i = 0; i < 1000; ++i) {
+        auto sp = MakeShared<Counted, AtomicPolicy>();
+        WeakPtr<Counted, AtomicPolicy> wp(sp);
+        std::vector<SharedPtr<Counted, AtomicPolicy>> copies(kNumThreads, sp);
+        sp.Reset();
+
+        std::vector<std::thread> threads;
+        for (auto& copy : copies) {
+            threads.emplace_back([&copy] { copy.Reset(); });
+        }
+        threads.emplace_back([&wp] { wp.Reset(); });
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(Counted::alive == 0);
+    }
+}
+
+TEST_CASE("Atomic strong only policy") {
+    {
+        auto sp = MakeShared<Counted, AtomicStrongOnlyPolicy>();
+        RunInThreads([sp] {
+            for (int i = 0; i < kNumIters; ++i) {
+                SharedPtr<Counted, AtomicStrongOnlyPolicy> copy = sp;
+            }
+        });
+        REQUIRE(sp.UseCount() == 1);
+        std::vector<SharedPtr<Counted, AtomicStrongOnlyPolicy>> copies(kNumThreads, sp);
+        sp.Reset();
+        std::vector<std::thread> threads;
+        for (auto& copy : copies) {
+            threads.emplace_back([&copy] { copy.Reset(); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    REQUIRE(Counted::alive == 0);
+}
+
+TEST_CASE("Recycling across threads") {
+    {
+        std::vector<SharedPtr<Counted, AtomicPolicy>> ptrs;
+        for (int i = 0; i < 1000; ++i) {
+            ptrs.push_back(RecyclingMakeShared<Counted, AtomicPolicy>());
+        }
+        std::atomic<size_t> next = 0;
+        // Blocks freed on other threads reach this one through the depot.
+        RunInThreads([&] {
+            for (size_t i = next++; i < ptrs.size(); i = next++) {
+                ptrs[i].Reset();
+            }
+            for (int i = 0; i < 1000; ++i) {
+                RecyclingMakeShared<Counted, AtomicPolicy>();
+            }
+        });
+        REQUIRE(Counted::alive == 0);
+    }
+}
+
+TEST_CASE("Immortal across threads") {
+    auto sp = MakeShared<int, AtomicPolicy>(1);
+    // Immortal objects are never freed, keep this one reachable.
+    static auto* block = sp.GetBlock();
+    MakeImmortal(sp);
+    int count = block->Get1();
+    RunInThreads([sp] {
+        for (int i = 0; i < kNumIters; ++i) {
+            SharedPtr<int, AtomicPolicy> copy = sp;
+            WeakPtr<int, AtomicPolicy> weak = copy;
+            weak.Lock();
+        }
+    });
+    sp.Reset();
+    REQUIRE(block->Get1() == count);
+}
+
+TEST_CASE("Biased policy") {
+    SECTION("Owner thread") {
+        {
+            auto sp = MakeShared<Counted, BiasedPolicy>();
+            std::vector<SharedPtr<Counted, BiasedPolicy>> copies(100, sp);
+            REQUIRE(sp.UseCount() == 101);
+            copies.clear();
+            REQUIRE(sp.UseCount() == 1);
+        }
+        REQUIRE(Counted::alive == 0);
+    }
+
+    SECTION("Escapes to other threads") {
+        for (int i = 0; i < 1000; ++i) {
+            SharedPtr<Counted, BiasedPolicy> sp(new Counted);
+            WeakPtr<Counted, BiasedPolicy> wp(sp);
+            std::vector<SharedPtr<Counted, BiasedPolicy>> copies(kNumThreads, sp);
+
+            std::vector<std::thread> threads;
+            for (auto& copy : copies) {
+                threads.emplace_back([&copy] {
+                    SharedPtr<Counted, BiasedPolicy> local = copy;
+                    copy.Reset();
+                });
+            }
+            sp.Reset();
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            // Copies made by the owner and released elsewhere wait for the owner.
+            BiasedPolicy::MergeQueued();
+            REQUIRE(Counted::alive == 0);
+            REQUIRE(wp.Expired());
+        }
+    }
+
+    SECTION("Last owner is another thread") {
+        SharedPtr<Counted, BiasedPolicy> sp(new Counted);
+        std::thread thread([copy = sp]() mutable { copy.Reset(); });
+        sp.Reset();
+        thread.join();
+        BiasedPolicy::MergeQueued();
+        REQUIRE(Counted::alive == 0);
+    }
+
+    SECTION("Owner locks after a remote last release") {
+        SharedPtr<Counted, BiasedPolicy> sp(new Counted);
+        WeakPtr<Counted, BiasedPolicy> wp(sp);
+        std::thread([copy = std::move(sp)]() mutable { copy.Reset(); }).join();
+        REQUIRE(wp.Expired());
+        REQUIRE(!wp.TryLock());
+        BiasedPolicy::MergeQueued();
+        REQUIRE(Counted::alive == 0);
+    }
+
+    SECTION("Owner exits first") {
+        SharedPtr<Counted, BiasedPolicy> sp;
+        std::thread([&sp] { sp = MakeShared<Counted, BiasedPolicy>(); }).join();
+        SharedPtr<Counted, BiasedPolicy> copy = sp;
+        REQUIRE(sp.UseCount() == 2);
+        sp.Reset();
+        REQUIRE(Counted::alive == 1);
+        copy.Reset();
+        REQUIRE(Counted::alive == 0);
+    }
+}
+
+template <typename Policy>
+void CheckConcurrentLock() {
+    for (int i = 0; i < 1000; ++i) {
+        auto sp = MakeShared<Counted, Policy>();
+        WeakPtr<Counted, Policy> wp(sp);
+        std::atomic<bool> consistent = true;
+
+        std::vector<std::thread> threads;
+        for (int j = 0; j < kNumThreads; ++j) {
+            threads.emplace_back([&wp, &consistent] {
+                for (int k = 0; k < 100; ++k) {
+                    auto locked = wp.TryLock();
+                    if (locked && Counted::alive != 1) {
+                        consistent = false;
+                    }
+                }
+            });
+        }
+        sp.Reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        if constexpr (std::is_same_v<Policy, BiasedPolicy>) {
+            BiasedPolicy::MergeQueued();
+        }
+        REQUIRE(consistent);
+        REQUIRE(wp.TryLock().Get() == nullptr);
+        REQUIRE(Counted::alive == 0);
+    }
+}
+
+TEST_CASE("Concurrent TryLock") {
+    SECTION("Atomic") {
+        CheckConcurrentLock<AtomicPolicy>();
+    }
+    SECTION("Biased") {
+        CheckConcurrentLock<BiasedPolicy>();
+    }
+}
+
+TEST_CASE("AtomicSharedPtr") {
+    SECTION("Load/Store") {
+        AtomicSharedPtr<std::string> atomic;
+        REQUIRE(atomic.IsLockFree());
+        REQUIRE(atomic.Load().Get() == nullptr);
+
+        auto sp = MakeShared<std::string, AtomicPolicy>("aba");
+        atomic.Store(sp);
+        REQUIRE(sp.UseCount() == 2);
+        auto loaded = atomic.Load();
+        REQUIRE(loaded == sp);
+        REQUIRE(sp.UseCount() == 3);
+
+        atomic.Store(nullptr);
+        REQUIRE(sp.UseCount() == 2);
+    }
+
+    SECTION("Exchange") {
+        AtomicSharedPtr<std::string> atomic(MakeShared<std::string, AtomicPolicy>("first"));
+        auto old = atomic.Exchange(MakeShared<std::string, AtomicPolicy>("second"));
+        REQUIRE(*old == "first");
+        REQUIRE(old.UseCount() == 1);
+        REQUIRE(*atomic.Load() == "second");
+    }
+
+    SECTION("CompareExchange") {
+        auto first = MakeShared<std::string, AtomicPolicy>("first");
+        auto second = MakeShared<std::string, AtomicPolicy>("second");
+        AtomicSharedPtr<std::string> atomic(first);
+
+        SharedPtr<std::string, AtomicPolicy> expected = second;
+        REQUIRE(!atomic.CompareExchange(expected, second));
+        REQUIRE(expected == first);
+        REQUIRE(second.UseCount() == 1);
+
+        REQUIRE(atomic.CompareExchange(expected, second));
+        REQUIRE(atomic.Load() == second);
+        REQUIRE(first.UseCount() == 2);
+    }
+
+    SECTION("Aliasing") {
+        struct Pair {
+            int first;
+            int second;
+        };
+        auto pair = MakeShared<Pair, AtomicPolicy>(Pair{1, 2});
+        {
+            AtomicSharedPtr<int> atomic(SharedPtr<int, AtomicPolicy>(pair, &pair->second));
+            auto loaded = atomic.Load();
+            REQUIRE(loaded.Get() == &pair->second);
+            REQUIRE(*loaded == 2);
+        }
+        REQUIRE(pair.UseCount() == 1);
+    }
+
+    SECTION("Concurrent readers") {
+        {
+            AtomicSharedPtr<Counted> atomic(MakeShared<Counted, AtomicPolicy>());
+            std::atomic<bool> stop = false;
+            std::atomic<bool> consistent = true;
+
+            std::vector<std::thread> readers;
+            for (int i = 0; i < kNumThreads; ++i) {
+                readers.emplace_back([&] {
+                    while (!stop) {
+                        auto loaded = atomic.Load();
+                        if (!loaded || loaded.UseCount() < 1) {
+                            consistent = false;
+                        }
+                    }
+                });
+            }
+            for (int i = 0; i < 10'000; ++i) {
+                atomic.Store(MakeShared<Counted, AtomicPolicy>());
+            }
+            stop = true;
+            for (auto& reader : readers) {
+                reader.join();
+            }
+            REQUIRE(consistent);
+            REQUIRE(Counted::alive == 1);
+        }
+        REQUIRE(Counted::alive == 0);
+    }
+}
@@ -1,10 +1,14 @@
 #include "shared.h"
+#include "thin_shared.h"
 
 #include <catch.hpp>
 
 #include "allocations_checker.h"
 
+#include <intrusive/intrusive.h>
+
 #include <memory>
+#include <stdexcept>
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -240,3 +244,819 @@ TEST_CASE("Modifiers") {
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Control block") {
+    SECTION("No vtable") {
+        static_assert(!std::is_polymorphic_v<ControlBlockBase<SingleThreadedPolicy>>);
+        static_assert(sizeof(ControlBlockBase<SingleThreadedPolicy>) ==
+                      sizeof(uint64_t) + sizeof(void*));
+        static_assert(sizeof(ControlBlockBase<AtomicPolicy>) == sizeof(uint64_t) + sizeof(void*));
+        static_assert(sizeof(EmplaceConterBlock<int, SingleThreadedPolicy>) ==
+                      sizeof(ControlBlockBase<SingleThreadedPolicy>) + alignof(void*));
+    }
+
+    SECTION("Object") {
+        auto sp = MakeShared<int>(42);
+        REQUIRE(sp.GetBlock()->Object() == sp.Get());
+        SharedPtr<std::string> str(new std::string("aba"));
+        REQUIRE(str.GetBlock()->Object() == str.Get());
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Pooled control blocks") {
+    using Pool = ControlBlockPool<PointingConterBlock<int, SingleThreadedPolicy>>;
+
+    // Warm up the pool of the calling thread.
+    std::vector<SharedPtr<int>> ptrs;
+    for (int i = 0; i < 10; ++i) {
+        ptrs.emplace_back(new int(i));
+    }
+    ptrs.clear();
+
+    PoolStats before = Pool::Stats();
+    EXPECT_ONE_ALLOCATION(SharedPtr<int> p(new int(42)));
+    {
+        SharedPtr<int> p;
+        EXPECT_ONE_ALLOCATION(p.Reset(new int(43)));
+        EXPECT_ONE_ALLOCATION(p.Reset(new int(44)));
+    }
+    PoolStats after = Pool::Stats();
+    REQUIRE(after.hits - before.hits == 3);
+    REQUIRE(after.misses == before.misses);
+
+    SECTION("Overflow to depot") {
+        for (int i = 0; i < 10 * static_cast<int>(Pool::kBatchSize); ++i) {
+            ptrs.emplace_back(new int(i));
+        }
+        ptrs.clear();
+        PoolStats warm = Pool::Stats();
+        for (int i = 0; i < 10 * static_cast<int>(Pool::kBatchSize); ++i) {
+            ptrs.emplace_back(new int(i));
+        }
+        REQUIRE(Pool::Stats().misses == warm.misses);
+        ptrs.clear();
+    }
+}
+
+struct ArenaStats {
+    static inline size_t used = 0;
+    static inline int allocations = 0;
+    static inline int deallocations = 0;
+};
+
+template <typename T>
+struct ArenaAllocator : ArenaStats {
+    using value_type = T;
+
+    explicit ArenaAllocator(std::vector<std::byte>* arena) : arena(arena) {
+    }
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {
+    }
+
+    T* allocate(size_t n) {
+        REQUIRE(used + n * sizeof(T) <= arena->size());
+        used += n * sizeof(T);
+        ++allocations;
+        return reinterpret_cast<T*>(arena->data());
+    }
+    void deallocate(T*, size_t) {
+        ++deallocations;
+    }
+
+    std::vector<std::byte>* arena;
+};
+
+TEST_CASE("AllocateShared") {
+    SECTION("Stateless allocator") {
+        using Block = AllocatedConterBlock<int, std::allocator<int>, SingleThreadedPolicy>;
+        static_assert(sizeof(Block) == sizeof(EmplaceConterBlock<int, SingleThreadedPolicy>));
+
+        EXPECT_ONE_ALLOCATION(REQUIRE(*AllocateShared<int>(std::allocator<int>(), 42) == 42));
+        auto sp = AllocateShared<std::string>(std::allocator<char>(), "aba");
+        REQUIRE(*sp == "aba");
+    }
+
+    SECTION("Stateful allocator") {
+        std::vector<std::byte> arena(1024);
+        ArenaAllocator<int> alloc(&arena);
+        WeakPtr<ModifiersC> weak;
+        {
+            SharedPtr<ModifiersC> sp;
+            EXPECT_ZERO_ALLOCATIONS(sp = AllocateShared<ModifiersC>(alloc));
+            REQUIRE(static_cast<void*>(sp.GetBlock()) == arena.data());
+            REQUIRE(ArenaStats::allocations == 1);
+            REQUIRE(ModifiersC::count == 1);
+            weak = sp;
+        }
+        REQUIRE(ModifiersC::count == 0);
+        REQUIRE(ArenaStats::deallocations == 0);
+        weak.Reset();
+        REQUIRE(ArenaStats::deallocations == 1);
+    }
+}
+
+struct CountingDeleter {
+    template <typename T>
+    void operator()(T* ptr) const {
+        ++calls;
+        delete ptr;
+    }
+
+    static inline int calls = 0;
+};
+
+void DeleteString(std::string* str) {
+    delete str;
+}
+
+// Moving it into a control block fails like an allocation would.
+struct ThrowingMoveDeleter {
+    ThrowingMoveDeleter() = default;
+    ThrowingMoveDeleter(ThrowingMoveDeleter&&) {
+        throw std::bad_alloc();
+    }
+    void operator()(int* ptr) const {
+        ++calls;
+        delete ptr;
+    }
+
+    static inline int calls = 0;
+};
+
+TEST_CASE("Custom deleters") {
+    SECTION("Empty deleter is free") {
+        static_assert(sizeof(PointingConterBlock<int, SingleThreadedPolicy, CountingDeleter>) ==
+                      sizeof(PointingConterBlock<int, SingleThreadedPolicy>));
+        auto lambda = [](int* ptr) { delete ptr; };
+        static_assert(sizeof(PointingConterBlock<int, SingleThreadedPolicy, decltype(lambda)>) ==
+                      sizeof(PointingConterBlock<int, SingleThreadedPolicy>));
+        SharedPtr<int> sp(new int(42), lambda);
+        REQUIRE(*sp == 42);
+    }
+
+    SECTION("Called once") {
+        CountingDeleter::calls = 0;
+        {
+            SharedPtr<ModifiersC> sp(new ModifiersC, CountingDeleter());
+            SharedPtr<ModifiersC> copy = sp;
+            sp.Reset();
+            REQUIRE(CountingDeleter::calls == 0);
+        }
+        REQUIRE(CountingDeleter::calls == 1);
+        REQUIRE(ModifiersC::count == 0);
+    }
+
+    SECTION("Reset") {
+        CountingDeleter::calls = 0;
+        SharedPtr<ModifiersB> sp(new ModifiersB);
+        sp.Reset(new ModifiersA, CountingDeleter());
+        REQUIRE(ModifiersA::count == 1);
+        REQUIRE(ModifiersB::count == 1);
+        sp.Reset();
+        REQUIRE(CountingDeleter::calls == 1);
+        SharedPtr<std::string> str;
+        str.Reset(new std::string("x"), &DeleteString);
+        REQUIRE(*str == "x");
+    }
+
+    SECTION("Failed block") {
+        ThrowingMoveDeleter::calls = 0;
+        REQUIRE_THROWS_AS(SharedPtr<int>(new int(1), ThrowingMoveDeleter()), std::bad_alloc);
+        REQUIRE(ThrowingMoveDeleter::calls == 1);
+    }
+
+    SECTION("Null with a deleter") {
+        int calls = 0;
+        {
+            SharedPtr<int> sp(nullptr, [&calls](int* ptr) { calls += ptr == nullptr; });
+            REQUIRE(!sp);
+            REQUIRE(sp.UseCount() == 1);
+        }
+        REQUIRE(calls == 1);
+    }
+
+    SECTION("Stateful deleter") {
+        int closed = 0;
+        int handle = 42;
+        {
+            SharedPtr<int> sp(&handle, [&closed](int* ptr) { closed = *ptr; });
+        }
+        REQUIRE(closed == 42);
+    }
+}
+
+struct ThrowingElement {
+    ThrowingElement() {
+        if (constructed == 3) {
+            throw std::runtime_error("fourth element");
+        }
+        ++constructed;
+    }
+    ~ThrowingElement() {
+        --constructed;
+    }
+
+    static inline int constructed = 0;
+};
+
+TEST_CASE("Arrays") {
+    SECTION("MakeShared") {
+        SharedPtr<int[]> sp;
+        EXPECT_ONE_ALLOCATION(sp = MakeShared<int[]>(5));
+        for (int i = 0; i < 5; ++i) {
+            REQUIRE(sp[i] == 0);
+            sp[i] = i;
+        }
+        SharedPtr<int[]> copy = sp;
+        REQUIRE(copy[4] == 4);
+        REQUIRE(copy.GetBlock()->Object() == copy.Get());
+        REQUIRE(sp.UseCount() == 2);
+    }
+
+    SECTION("Elements are destroyed") {
+        WeakPtr<ModifiersC[]> weak;
+        {
+            auto sp = MakeShared<ModifiersC[]>(3);
+            REQUIRE(ModifiersC::count == 3);
+            weak = sp;
+            REQUIRE(weak.Lock()[2].count == 3);
+        }
+        REQUIRE(ModifiersC::count == 0);
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Constructor throws") {
+        REQUIRE_THROWS_AS(MakeShared<ThrowingElement[]>(5), std::runtime_error);
+        REQUIRE(ThrowingElement::constructed == 0);
+    }
+
+    SECTION("Empty and over-aligned") {
+        auto empty = MakeShared<double[]>(0);
+        REQUIRE(empty.Get() != nullptr);
+
+        struct alignas(64) Wide {
+            char c = 'x';
+        };
+        auto wide = MakeShared<Wide[]>(3);
+        REQUIRE(reinterpret_cast<uintptr_t>(wide.Get()) % 64 == 0);
+        REQUIRE(wide[2].c == 'x');
+    }
+
+    SECTION("Adopted array") {
+        {
+            SharedPtr<ModifiersC[]> sp(new ModifiersC[4]);
+            REQUIRE(ModifiersC::count == 4);
+            sp.Reset(new ModifiersC[2]);
+            REQUIRE(ModifiersC::count == 2);
+        }
+        REQUIRE(ModifiersC::count == 0);
+    }
+
+    SECTION("Conversions") {
+        static_assert(!std::is_constructible_v<SharedPtr<ModifiersB[]>, ModifiersA*>);
+        static_assert(!std::is_constructible_v<SharedPtr<ModifiersB[]>, SharedPtr<ModifiersA[]>>);
+        static_assert(!std::is_constructible_v<SharedPtr<int[]>, SharedPtr<int>>);
+        static_assert(!std::is_constructible_v<SharedPtr<int>, SharedPtr<int[]>>);
+        static_assert(!std::is_assignable_v<SharedPtr<int[]>&, SharedPtr<int>>);
+        static_assert(!std::is_assignable_v<SharedPtr<int>&, const SharedPtr<int[]>&>);
+        static_assert(!std::is_constructible_v<WeakPtr<int[]>, SharedPtr<int>>);
+
+        SharedPtr<const int[]> constant = MakeShared<int[]>(2);
+        REQUIRE(constant[1] == 0);
+        SharedPtr<ModifiersB> base(new ModifiersA);
+        REQUIRE(base.Get());
+    }
+}
+
+TEST_CASE("MakeSharedForOverwrite") {
+    struct Frame {
+        int header = 7;
+        std::byte data[1000];
+    };
+
+    SECTION("Object") {
+        SharedPtr<Frame> frame;
+        EXPECT_ONE_ALLOCATION(frame = MakeSharedForOverwrite<Frame>());
+        REQUIRE(frame->header == 7);
+        {
+            auto sp = MakeSharedForOverwrite<ModifiersC>();
+            REQUIRE(ModifiersC::count == 1);
+        }
+        REQUIRE(ModifiersC::count == 0);
+    }
+
+    SECTION("Array") {
+        SharedPtr<std::byte[]> buffer;
+        EXPECT_ONE_ALLOCATION(buffer = MakeSharedForOverwrite<std::byte[]>(1 << 20));
+        buffer[(1 << 20) - 1] = std::byte(1);
+        REQUIRE(buffer[(1 << 20) - 1] == std::byte(1));
+
+        auto strings = MakeSharedForOverwrite<std::string[]>(3);
+        REQUIRE(strings[2].empty());
+    }
+}
+
+template <size_t kSize>
+struct Payload {
+    explicit Payload(int value) : value(value) {
+    }
+
+    static void* operator new(size_t size) {
+        return ::operator new(size);
+    }
+    static void operator delete(void* ptr) {
+        ++freed;
+        ::operator delete(ptr);
+    }
+
+    int value;
+    char data[kSize];
+
+    static inline int freed = 0;
+};
+
+TEST_CASE("MakeSharedSplit") {
+    SECTION("Small objects share the block") {
+        SharedPtr<Payload<16>> sp;
+        EXPECT_ONE_ALLOCATION(sp = MakeSharedSplit<Payload<16>>(1));
+        REQUIRE(sp->value == 1);
+        REQUIRE(sp.GetBlock()->Object() == sp.Get());
+    }
+
+    SECTION("Large objects are freed with the last strong reference") {
+        using Big = Payload<kSplitThreshold>;
+        Big::freed = 0;
+        auto sp = MakeSharedSplit<Big>(2);
+        REQUIRE(sp->value == 2);
+        WeakPtr<Big> weak = sp;
+        sp.Reset();
+        REQUIRE(Big::freed == 1);
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Custom threshold") {
+        Payload<16>::freed = 0;
+        auto sp = MakeSharedSplit<Payload<16>, SingleThreadedPolicy, 8>(3);
+        REQUIRE(sp->value == 3);
+        WeakPtr<Payload<16>> weak = sp;
+        sp.Reset();
+        REQUIRE(Payload<16>::freed == 1);
+    }
+}
+
+TEST_CASE("ThinSharedPtr") {
+    static_assert(sizeof(ThinSharedPtr<int>) == sizeof(void*));
+    static_assert(sizeof(ThinSharedPtr<int>) * 2 == sizeof(SharedPtr<int>));
+
+    SECTION("MakeThinShared") {
+        ThinSharedPtr<std::string> thin;
+        EXPECT_ONE_ALLOCATION(thin = MakeThinShared<std::string>("aba"));
+        REQUIRE(*thin == "aba");
+        REQUIRE(thin->size() == 3);
+        REQUIRE(thin.Get() == thin.GetBlock()->Object());
+
+        ThinSharedPtr<std::string> copy = thin;
+        REQUIRE(copy == thin);
+        REQUIRE(thin.UseCount() == 2);
+        copy.Reset();
+        REQUIRE(!copy);
+        REQUIRE(thin.UseCount() == 1);
+    }
+
+    SECTION("Round trip") {
+        WeakPtr<ModifiersC> weak;
+        {
+            auto sp = MakeShared<ModifiersC>();
+            ThinSharedPtr<ModifiersC> thin(sp);
+            REQUIRE(thin.Get() == sp.Get());
+            REQUIRE(sp.UseCount() == 2);
+            SharedPtr<ModifiersC> back = thin;
+            REQUIRE(back.Get() == sp.Get());
+            REQUIRE(sp.UseCount() == 3);
+            weak = back;
+        }
+        REQUIRE(ModifiersC::count == 0);
+        REQUIRE(weak.Expired());
+
+        auto aligned = MakeThinShared<std::max_align_t>();
+        REQUIRE(aligned.Get() == aligned.GetBlock()->Object());
+        auto biased = MakeThinShared<int, AtomicPolicy>(42);
+        REQUIRE(*biased == 42);
+    }
+
+    SECTION("Not thin") {
+        SharedPtr<int> adopted(new int(42));
+        REQUIRE_THROWS_AS(ThinSharedPtr<int>(adopted), BadThinSharedPtr);
+        REQUIRE(adopted.UseCount() == 1);
+
+        struct Pair {
+            int first = 1;
+            int second = 2;
+        };
+        auto pair = MakeShared<Pair>();
+        SharedPtr<int> alias(pair, &pair->second);
+        REQUIRE_THROWS_AS(ThinSharedPtr<int>(alias), BadThinSharedPtr);
+        REQUIRE(ThinSharedPtr<int>(SharedPtr<int>(pair, &pair->first)).UseCount() == 3);
+
+        ThinSharedPtr<int> empty((SharedPtr<int>()));
+        REQUIRE(empty.Get() == nullptr);
+    }
+}
+
+TEST_CASE("Strong only policy") {
+    using Ptr = SharedPtr<ModifiersC, StrongOnlyPolicy>;
+    static_assert(!kCountsWeak<StrongOnlyPolicy>);
+    static_assert(kCountsWeak<SingleThreadedPolicy> && kCountsWeak<BiasedPolicy>);
+
+    {
+        Ptr sp;
+        EXPECT_ONE_ALLOCATION(sp = MakeShared<ModifiersC, StrongOnlyPolicy>());
+        Ptr copy = sp;
+        REQUIRE(sp.UseCount() == 2);
+        sp.Reset();
+        REQUIRE(ModifiersC::count == 1);
+        REQUIRE(copy.UseCount() == 1);
+    }
+    REQUIRE(ModifiersC::count == 0);
+
+    SharedPtr<std::string, StrongOnlyPolicy> adopted(new std::string("aba"));
+    adopted.Reset(new std::string("caba"));
+    REQUIRE(*adopted == "caba");
+    auto array = MakeShared<int[], StrongOnlyPolicy>(4);
+    REQUIRE(array[3] == 0);
+}
+
+struct Node : SimpleRefCounted<Node> {
+    explicit Node(int value = 0) : value(value) {
+        ++alive;
+    }
+    virtual ~Node() {
+        --alive;
+    }
+
+    int value;
+
+    static inline int alive = 0;
+};
+
+struct Leaf : Node {
+    Leaf() : Node(1) {
+    }
+};
+
+struct Shape {
+    virtual ~Shape() = default;
+};
+
+struct Circle : Shape, SimpleRefCounted<Circle> {
+    Circle() {
+        ++alive;
+    }
+    ~Circle() override {
+        --alive;
+    }
+
+    static inline int alive = 0;
+};
+
+TEST_CASE("RefCounted objects") {
+    static_assert(kRefCounted<Node> && kRefCounted<Leaf>);
+    static_assert(!kRefCounted<ModifiersC> && !kRefCounted<int> && !kRefCounted<void>);
+
+    SECTION("Behind a plain base") {
+        {
+            SharedPtr<Shape> shape(new Circle);
+            REQUIRE(shape.GetBlock() != nullptr);
+            SharedPtr<Shape> copy = shape;
+            REQUIRE(shape.UseCount() == 2);
+            REQUIRE(static_cast<Circle*>(copy.Get())->RefCount() == 0);
+            SharedPtr<Shape> deleted(new Circle, [](Circle* circle) { delete circle; });
+            REQUIRE(Circle::alive == 2);
+        }
+        REQUIRE(Circle::alive == 0);
+        {
+            SharedPtr<Circle> circle(new Circle);
+            REQUIRE(circle.GetBlock() == nullptr);
+            SharedPtr<Circle> copy = circle;
+            REQUIRE(circle->RefCount() == 2);
+        }
+        REQUIRE(Circle::alive == 0);
+    }
+
+    SECTION("Const objects") {
+        {
+            SharedPtr<const Node> sp(new Node(7));
+            REQUIRE(sp.GetBlock() == nullptr);
+            SharedPtr<const Node> copy = sp;
+            REQUIRE(sp.UseCount() == 2);
+            SharedPtr<const Node> made = MakeShared<Node>(8);
+            REQUIRE(made->value == 8);
+        }
+        REQUIRE(Node::alive == 0);
+    }
+
+    SECTION("No control block") {
+        {
+            SharedPtr<Node> sp;
+            EXPECT_ONE_ALLOCATION(sp = MakeShared<Node>(42));
+            REQUIRE(sp.GetBlock() == nullptr);
+            REQUIRE(sp->value == 42);
+            SharedPtr<Node> copy;
+            EXPECT_ZERO_ALLOCATIONS(copy = sp);
+            REQUIRE(sp.UseCount() == 2);
+            REQUIRE(sp->RefCount() == 2);
+            sp.Reset();
+            REQUIRE(copy.UseCount() == 1);
+            REQUIRE(Node::alive == 1);
+        }
+        REQUIRE(Node::alive == 0);
+    }
+
+    SECTION("Adopted pointer") {
+        {
+            SharedPtr<Node> sp;
+            EXPECT_ONE_ALLOCATION(sp = SharedPtr<Node>(new Node(1)));
+            sp.Reset(new Node(2));
+            REQUIRE(Node::alive == 1);
+            SharedPtr<Node> base(new Leaf);
+            REQUIRE(base->value == 1);
+            SharedPtr<Node> derived = MakeShared<Leaf>();
+            REQUIRE(derived.UseCount() == 1);
+        }
+        REQUIRE(Node::alive == 0);
+    }
+
+    SECTION("Shared with IntrusivePtr") {
+        {
+            IntrusivePtr<Node> intrusive = MakeIntrusive<Node>(7);
+            SharedPtr<Node> shared = intrusive;
+            REQUIRE(intrusive.UseCount() == 2);
+            IntrusivePtr<Node> back(shared.Get());
+            REQUIRE(shared.UseCount() == 3);
+            intrusive.Reset();
+            back.Reset();
+            REQUIRE(shared->value == 7);
+            REQUIRE(Node::alive == 1);
+        }
+        REQUIRE(Node::alive == 0);
+    }
+}
+
+struct alignas(64) Simd {
+    float lanes[16] = {};
+};
+
+struct alignas(256) Page {
+    int first = 1;
+};
+
+TEST_CASE("Alignment") {
+    auto aligned = [](const void* ptr, size_t alignment) {
+        return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+    };
+
+    SECTION("Over-aligned objects") {
+        for (int i = 0; i < 10; ++i) {
+            auto simd = MakeShared<Simd>();
+            REQUIRE(aligned(simd.Get(), 64));
+            auto page = MakeShared<Page, AtomicPolicy>();
+            REQUIRE(aligned(page.Get(), 256));
+            REQUIRE(page->first == 1);
+            SharedPtr<Page> adopted(new Page);
+            REQUIRE(aligned(adopted.Get(), 256));
+            auto allocated = AllocateShared<Simd>(std::allocator<Simd>());
+            REQUIRE(aligned(allocated.Get(), 64));
+        }
+    }
+
+    SECTION("Padded") {
+        SharedPtr<int, AtomicPolicy> sp;
+        EXPECT_ONE_ALLOCATION(sp = MakeSharedPadded<int, AtomicPolicy>(42));
+        REQUIRE(*sp == 42);
+        auto* block = reinterpret_cast<std::byte*>(sp.GetBlock());
+        auto* object = reinterpret_cast<std::byte*>(sp.Get());
+        REQUIRE(aligned(block, kCacheLineSize));
+        REQUIRE(object - block == kCacheLineSize);
+        REQUIRE(sp.GetBlock()->Object() == sp.Get());
+
+        auto page = MakeSharedPadded<Page>();
+        REQUIRE(aligned(page.Get(), 256));
+        using Thin = ThinSharedPtr<int, AtomicPolicy>;
+        REQUIRE_THROWS_AS(Thin(sp), BadThinSharedPtr);
+    }
+}
+
+struct Request {
+    explicit Request(std::string path) : path(std::move(path)) {
+        order.push_back("request");
+    }
+    ~Request() {
+        order.push_back("~request");
+    }
+
+    std::string path;
+
+    static inline std::vector<std::string> order;
+};
+
+struct Response : EnableSharedFromThis<Response> {
+    Response(int code, std::string body) : code(code), body(std::move(body)) {
+        Request::order.push_back("response");
+    }
+    ~Response() {
+        Request::order.push_back("~response");
+    }
+
+    int code;
+    std::string body;
+};
+
+struct FailingPart {
+    FailingPart() {
+        throw std::runtime_error("part");
+    }
+};
+
+TEST_CASE("MakeSharedGroup") {
+    Request::order.clear();
+
+    SECTION("One allocation") {
+        SharedPtr<Request> request;
+        SharedPtr<Response> response;
+        SharedPtr<int> number;
+        std::tie(request, response, number) = MakeSharedGroup<Request, Response, int>(
+            std::forward_as_tuple("/index"), std::forward_as_tuple(200, "ok"), std::make_tuple(42));
+        REQUIRE(request->path == "/index");
+        REQUIRE(response->code == 200);
+        REQUIRE(response->body == "ok");
+        REQUIRE(*number == 42);
+        REQUIRE(request.GetBlock() == response.GetBlock());
+        REQUIRE(request.UseCount() == 3);
+        REQUIRE(response->SharedFromThis() == response);
+
+        request.Reset();
+        number.Reset();
+        REQUIRE(Request::order.size() == 2);
+        response.Reset();
+        REQUIRE(Request::order ==
+                std::vector<std::string>{"request", "response", "~response", "~request"});
+    }
+
+    SECTION("Constructor throws") {
+        auto make = [] {
+            MakeSharedGroup<Request, FailingPart>(std::forward_as_tuple("/"), std::tuple<>());
+        };
+        REQUIRE_THROWS_AS(make(), std::runtime_error);
+        REQUIRE(Request::order == std::vector<std::string>{"request", "~request"});
+    }
+
+    SECTION("Policy") {
+        std::tuple<SharedPtr<int, AtomicPolicy>, SharedPtr<double, AtomicPolicy>> group;
+        EXPECT_ONE_ALLOCATION(group = MakeSharedGroupWith<AtomicPolicy, int, double>(
+                                  std::make_tuple(1), std::make_tuple(2.5)));
+        auto& [a, b] = group;
+        REQUIRE(*a == 1);
+        REQUIRE(*b == 2.5);
+        REQUIRE(b.UseCount() == 2);
+    }
+}
+
+TEST_CASE("MakeSharedBatch") {
+    SECTION("Contiguous") {
+        auto nodes = MakeSharedBatch<std::string>(100, [](size_t i) { return std::to_string(i); });
+        REQUIRE(nodes.size() == 100);
+        using Block = SlabConterBlock<std::string, SingleThreadedPolicy>;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            REQUIRE(*nodes[i] == std::to_string(i));
+            REQUIRE(nodes[i].UseCount() == 1);
+            REQUIRE(nodes[i].GetBlock()->Object() == nodes[i].Get());
+            if (i > 0) {
+                auto* prev = reinterpret_cast<std::byte*>(nodes[i - 1].GetBlock());
+                REQUIRE(reinterpret_cast<std::byte*>(nodes[i].GetBlock()) - prev == sizeof(Block));
+            }
+        }
+        REQUIRE(MakeSharedBatch<int>(0, [](size_t) { return 0; }).empty());
+    }
+
+    SECTION("Separate lifetimes") {
+        WeakPtr<ModifiersC> weak;
+        SharedPtr<ModifiersC> survivor;
+        {
+            auto batch = MakeSharedBatch<ModifiersC>(10, [](size_t) { return ModifiersC(); });
+            REQUIRE(ModifiersC::count == 10);
+            weak = batch[3];
+            survivor = batch[7];
+        }
+        REQUIRE(ModifiersC::count == 1);
+        REQUIRE(weak.Expired());
+        survivor.Reset();
+        REQUIRE(ModifiersC::count == 0);
+        // The slab goes with the weak reference to its last block.
+        weak.Reset();
+    }
+
+    SECTION("Init throws") {
+        auto init = [](size_t i) {
+            if (i == 5) {
+                throw std::runtime_error("init");
+            }
+            return ModifiersC();
+        };
+        REQUIRE_THROWS_AS(MakeSharedBatch<ModifiersC>(10, init), std::runtime_error);
+        REQUIRE(ModifiersC::count == 0);
+    }
+
+    SECTION("Atomic policy") {
+        auto batch = MakeSharedBatch<Simd, AtomicPolicy>(3, [](size_t) { return Simd(); });
+        for (auto& simd : batch) {
+            REQUIRE(reinterpret_cast<uintptr_t>(simd.Get()) % 64 == 0);
+        }
+    }
+}
+
+struct Message {
+    int id;
+    char body[100];
+};
+
+TEST_CASE("RecyclingMakeShared") {
+    PoolStats start = RecyclingStats<Message>();
+    {
+        auto first = RecyclingMakeShared<Message>(Message{1, {}});
+        REQUIRE(first->id == 1);
+        REQUIRE(first.GetBlock()->Object() == first.Get());
+    }
+    PoolStats warm = RecyclingStats<Message>();
+    REQUIRE(warm.hits + warm.misses == start.hits + start.misses + 1);
+
+    for (int i = 0; i < 1000; ++i) {
+        SharedPtr<Message> message;
+        EXPECT_ZERO_ALLOCATIONS(message = RecyclingMakeShared<Message>(Message{i, {}}));
+        REQUIRE(message->id == i);
+    }
+    PoolStats after = RecyclingStats<Message>();
+    REQUIRE(after.hits - warm.hits == 1000);
+    REQUIRE(after.misses == warm.misses);
+
+    SECTION("Separate pool per type") {
+        PoolStats other = RecyclingStats<Message, AtomicPolicy>();
+        auto atomic = RecyclingMakeShared<Message, AtomicPolicy>(Message{2, {}});
+        REQUIRE(RecyclingStats<Message, AtomicPolicy>().hits +
+                    RecyclingStats<Message, AtomicPolicy>().misses ==
+                other.hits + other.misses + 1);
+        REQUIRE(RecyclingStats<Message>().hits == after.hits);
+    }
+
+    SECTION("Survives weak references") {
+        WeakPtr<std::string> weak;
+        {
+            auto str = RecyclingMakeShared<std::string>(100, 'x');
+            weak = str;
+        }
+        REQUIRE(weak.Expired());
+    }
+}
+
+TEST_CASE("Immortal objects") {
+    SECTION("Packed counters") {
+        auto sp = MakeShared<std::string>("config");
+        // Immortal objects are never freed, keep this one reachable.
+        static auto* block = sp.GetBlock();
+        MakeImmortal(sp);
+        int count = block->Get1();
+        REQUIRE(count >= static_cast<int>(kImmortalCount));
+        WeakPtr<std::string> weak = sp;
+        {
+            auto copy = sp;
+            REQUIRE(sp.UseCount() == static_cast<size_t>(count));
+        }
+        sp.Reset();
+        REQUIRE(block->Get1() == count);
+        REQUIRE(!weak.Expired());
+        REQUIRE(*weak.Lock() == "config");
+    }
+
+    SECTION("Strong only policy") {
+        auto sp = MakeShared<int, StrongOnlyPolicy>(5);
+        static auto* block = sp.GetBlock();
+        MakeImmortal(sp);
+        int count = block->Get1();
+        REQUIRE(count >= static_cast<int>(kImmortalCount));
+        auto copy = sp;
+        sp.Reset();
+        copy.Reset();
+        REQUIRE(block->Get1() == count);
+    }
+
+    SECTION("RefCounted objects") {
+        static auto* node = new Node(3);
+        SharedPtr<Node> sp(node);
+        MakeImmortal(sp);
+        size_t count = sp.UseCount();
+        sp.Reset();
+        REQUIRE(node->RefCount() == count);
+    }
+}
@@ -175,3 +175,21 @@ TEST_CASE("Lifetimes") {
         delete wp;
     }
 }
+
+TEST_CASE("TryLock") {
+    WeakPtr<std::string> wp;
+    REQUIRE(wp.TryLock().Get() == nullptr);
+    static_assert(noexcept(wp.TryLock()), "Operation must be noexcept");
+    static_assert(noexcept(wp.Lock()), "Operation must be noexcept");
+
+    {
+        auto sp = MakeShared<std::string>("aba");
+        wp = sp;
+        auto locked = wp.TryLock();
+        REQUIRE(*locked == "aba");
+        REQUIRE(sp.UseCount() == 2);
+    }
+    REQUIRE(wp.Expired());
+    REQUIRE(wp.TryLock().Get() == nullptr);
+    REQUIRE(wp.UseCount() == 0);
+}
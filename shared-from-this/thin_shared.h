@@ -0,0 +1,145 @@
+#pragma once
+
+#include "shared.h"
+
+#include <cstddef>
+#include <utility>
+
+class BadThinSharedPtr : public std::exception {
+public:
+};
+
+// `SharedPtr` of a `MakeShared` object that keeps the block pointer only: such
+// an object always sits at a fixed offset from its block. Half the size of
+// `SharedPtr`, but aliasing and converted pointers can't be thin; convert to
+// `SharedPtr` for those.
+template <typename T, typename Policy = SingleThreadedPolicy>
+class ThinSharedPtr {
+    static_assert(!std::is_array_v<T>, "ThinSharedPtr does not support arrays");
+
+    using Block = ControlBlockBase<Policy>;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    ThinSharedPtr() : block_(nullptr) {
+    }
+    ThinSharedPtr(std::nullptr_t) : block_(nullptr) {
+    }
+
+    // Takes over the reference of `other`. Throws `BadThinSharedPtr` if it
+    // does not point to the object of a `MakeShared` block.
+    explicit ThinSharedPtr(SharedPtr<T, Policy> other) : block_(other.GetBlock()) {
+        static_assert(!kRefCounted<T>, "RefCounted objects have no control block");
+        if (!block_) {
+            return;
+        }
+        if (ObjectOf(block_) != other.Get()) {
+            block_ = nullptr;
+            throw BadThinSharedPtr();
+        }
+        other.Set(nullptr);
+        other.SetBlock(nullptr);
+    }
+
+    ThinSharedPtr(const ThinSharedPtr& other) : block_(other.block_) {
+        if (block_) {
+            block_->Increment();
+        }
+    }
+    ThinSharedPtr(ThinSharedPtr&& other) noexcept : block_(other.block_) {
+        other.block_ = nullptr;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    ThinSharedPtr& operator=(const ThinSharedPtr& other) {
+        ThinSharedPtr(other).Swap(*this);
+        return *this;
+    }
+    ThinSharedPtr& operator=(ThinSharedPtr&& other) noexcept {
+        ThinSharedPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~ThinSharedPtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        // Hand the reference to a `SharedPtr` that releases it.
+        ToShared(std::exchange(block_, nullptr));
+    }
+    void Swap(ThinSharedPtr& other) {
+        std::swap(block_, other.block_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return block_ ? ObjectOf(block_) : nullptr;
+    }
+    T& operator*() const {
+        return *ObjectOf(block_);
+    }
+    T* operator->() const {
+        return ObjectOf(block_);
+    }
+    size_t UseCount() const {
+        return block_ ? block_->Get1() : 0;
+    }
+    explicit operator bool() const {
+        return block_ != nullptr;
+    }
+    Block* GetBlock() const {
+        return block_;
+    }
+
+    // A full `SharedPtr` sharing ownership with this one.
+    operator SharedPtr<T, Policy>() const {
+        if (block_) {
+            block_->Increment();
+        }
+        return ToShared(block_);
+    }
+
+private:
+    // `EmplaceConterBlock` keeps the object right after the base block.
+    static constexpr size_t kObjectOffset =
+        (sizeof(Block) + alignof(T) - 1) / alignof(T) * alignof(T);
+
+    static T* ObjectOf(Block* block) {
+        return reinterpret_cast<T*>(reinterpret_cast<std::byte*>(block) + kObjectOffset);
+    }
+
+    // Wraps a reference to `block` into a `SharedPtr`.
+    static SharedPtr<T, Policy> ToShared(Block* block) {
+        SharedPtr<T, Policy> result;
+        if (block) {
+            result.Set(ObjectOf(block));
+            result.SetBlock(block);
+        }
+        return result;
+    }
+
+    Block* block_;
+};
+
+template <typename T, typename U, typename Policy>
+inline bool operator==(const ThinSharedPtr<T, Policy>& left, const ThinSharedPtr<U, Policy>& right) {
+    return left.Get() == right.Get();
+}
+
+template <typename T, typename Policy = SingleThreadedPolicy, typename... Args>
+ThinSharedPtr<T, Policy> MakeThinShared(Args&&... args) {
+    return ThinSharedPtr<T, Policy>(MakeShared<T, Policy>(std::forward<Args>(args)...));
+}
@@ -4,9 +4,13 @@
 #include "sw_fwd.h"  // Forward declaration
 
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
-template <typename T>
+template <typename T, typename Policy>
 class WeakPtr {
+    static_assert(kCountsWeak<Policy>, "the policy of this SharedPtr does not support WeakPtr");
+
 public:
+    using ElementType = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -16,7 +20,7 @@ public:
     WeakPtr(const WeakPtr& other) {
         ptr_ = other.ptr_;
         block_ = other.block_;
-        if (!other.Expired()) {
+        if (block_) {
             block_->IncrementWeak();
         }
     }
@@ -24,14 +28,15 @@ public:
         other.ptr_ = nullptr;
         other.block_ = nullptr;
     }
-    template <typename U>
-    WeakPtr(const WeakPtr<U>& other) : ptr_(other.Get()), block_(other.GetBlock()) {
+    template <typename U, typename = std::enable_if_t<kCompatiblePtr<U, T>>>
+    WeakPtr(const WeakPtr<U, Policy>& other) : ptr_(other.Get()), block_(other.GetBlock()) {
         if (block_) {
             block_->IncrementWeak();
         }
     }
-    template <typename U>
-    WeakPtr(const SharedPtr<U>& other) : ptr_(other.Get()), block_(other.GetBlock()) {
+    template <typename U, typename = std::enable_if_t<kCompatiblePtr<U, T>>>
+    WeakPtr(const SharedPtr<U, Policy>& other) : ptr_(other.Get()), block_(other.GetBlock()) {
+        static_assert(!kRefCounted<std::remove_extent_t<U>>, "RefCounted objects have no weak count");
         if (block_) {
             block_->IncrementWeak();
         }
@@ -39,7 +44,8 @@ public:
 
     // Demote `SharedPtr`
     // #2 from https://en.cppreference.com/w/cpp/memory/weak_ptr/weak_ptr
-    WeakPtr(const SharedPtr<T>& other) {
+    WeakPtr(const SharedPtr<T, Policy>& other) {
+        static_assert(!kRefCounted<ElementType>, "RefCounted objects have no weak count");
         ptr_ = other.Get();
         block_ = other.GetBlock();
         if (block_ != nullptr) {
@@ -53,7 +59,6 @@ public:
     WeakPtr& operator=(const WeakPtr& other) noexcept {
         if (this != &other) {
             if (block_) {
-                block_->DecrementWeak();
                 Realise();
             }
             ptr_ = other.ptr_;
@@ -65,8 +70,8 @@ public:
         return *this;
     }
     void Realise() const {
-        if (block_->Get1() + block_->Get2() == 0) {
-            delete block_;
+        if (block_->DecrementWeak()) {
+            block_->Deallocate();
         }
     }
     WeakPtr& operator=(WeakPtr&& other) noexcept {
@@ -92,10 +97,10 @@ public:
     ~WeakPtr() {
         Reset();
     }
-    T* Get() const {
+    ElementType* Get() const {
         return ptr_;
     }
-    ControlBlockBase* GetBlock() const {
+    ControlBlockBase<Policy>* GetBlock() const {
         return block_;
     }
 
@@ -103,11 +108,8 @@ public:
     // Modifiers
 
     void Reset() {
-        if (ptr_ != nullptr) {
-            block_->DecrementWeak();
-            if (block_->Get2() == 0) {
-                Realise();
-            }
+        if (block_ != nullptr) {
+            Realise();
             block_ = nullptr;
             ptr_ = nullptr;
         }
@@ -129,16 +131,30 @@ public:
         }
         return false;
     }
-    SharedPtr<T> Lock() const {
-        if (!Expired()) {
-            return SharedPtr<T>(*this);
-        } else {
-            return SharedPtr<T>();
+    SharedPtr<T, Policy> Lock() const noexcept {
+        return TryLock();
+    }
+    // Returns an empty pointer if the object has expired, never throws.
+    SharedPtr<T, Policy> TryLock() const noexcept {
+        SharedPtr<T, Policy> result;
+        if (block_ && block_->IncrementIfNotZero()) {
+            result.Set(ptr_);
+            result.SetBlock(block_);
         }
+        return result;
     }
 
 private:
-    friend class SharedPtr<T>;
-    T* ptr_;
-    ControlBlockBase* block_;
+    // Takes a new weak reference to `block`.
+    WeakPtr(ElementType* ptr, ControlBlockBase<Policy>* block) : ptr_(ptr), block_(block) {
+        if (block_) {
+            block_->IncrementWeak();
+        }
+    }
+
+    friend class SharedPtr<T, Policy>;
+    template <typename U, typename P>
+    friend class EnableSharedFromThis;
+    ElementType* ptr_;
+    ControlBlockBase<Policy>* block_;
 };